@@ -20,10 +20,17 @@
 #define itkVectorFieldPCA_h
 
 #include "itkObject.h"
+#include "itkImage.h"
 #include "itkPointSet.h"
 #include "itkKernelFunctionBase.h"
+#include "itkMultiThreaderBase.h"
 #include "vnl/vnl_vector.h"
 #include "vnl/vnl_matrix.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace itk
 {
@@ -153,6 +160,12 @@ public:
   using VectorFieldSetTypePointer = typename VectorFieldSetType::Pointer;
   using VectorFieldSetTypeConstPointer = typename VectorFieldSetType::ConstPointer;
 
+  /** Type of the vector fields stored in one contiguous buffer: the image
+   * has size PointDim x VertexCount x SetSize, so that sample j is the
+   * row-major VertexCount x PointDim block at offset j * VertexCount *
+   * PointDim. */
+  using VectorFieldImageType = Image<TVectorFieldElementType, 3>;
+
   /** types for the output. */
   using MatrixType = vnl_matrix<TPCType>;
   using VectorType = vnl_vector<TPCType>;
@@ -161,6 +174,7 @@ public:
   using ResSetType = VectorContainer<unsigned int, VectorType>;
 
   using BasisSetTypePointer = typename BasisSetType::Pointer;
+  using ResSetTypePointer = typename ResSetType::Pointer;
   using KernelFunctionPointer = typename KernelFunctionType::Pointer;
 
   /**
@@ -175,6 +189,15 @@ public:
   itkSetMacro(VectorFieldSet, VectorFieldSetTypePointer);
   itkGetMacro(VectorFieldSet, VectorFieldSetTypePointer);
 
+  /**
+   * \brief Set and get the vector fields as one contiguous buffer, instead
+   * of the vector field set. The buffer is read in place, so an N x V x D
+   * array, for example a NumPy array viewed with
+   * itk.image_view_from_array(), is not copied.
+   */
+  itkSetConstObjectMacro(VectorFieldImage, VectorFieldImageType);
+  itkGetConstObjectMacro(VectorFieldImage, VectorFieldImageType);
+
   /**
    * \brief Set and get the PCA count.
    */
@@ -186,6 +209,132 @@ public:
    */
   itkSetMacro(KernelFunction, KernelFunctionPointer);
 
+  /**
+   * \brief Set and get the multithreader used by the parallel parts of the
+   * computation. Calculators that compute at the same time must not share
+   * one, unless it is a TBBMultiThreader.
+   */
+  itkSetObjectMacro(MultiThreader, MultiThreaderBase);
+  itkGetModifiableObjectMacro(MultiThreader, MultiThreaderBase);
+
+  /**
+   * \brief Set and get the low memory mode.
+   *
+   * In low memory mode the kernel matrix is never stored, the Gram matrix
+   * is double-centered in place and released once it has been
+   * decomposed, and only the requested eigenvectors are kept. The results
+   * are the same, but ComputeReplicates() is no longer available.
+   */
+  itkSetMacro(LowMemory, bool);
+  itkGetConstMacro(LowMemory, bool);
+  itkBooleanMacro(LowMemory);
+
+  /**
+   * \brief Set and get the lazy basis mode.
+   *
+   * By default Compute() reconstructs all the basis vectors. In lazy mode
+   * no basis vector is reconstructed until GetBasisVector(),
+   * GetBasisVectors() or GetBasisBlock() asks for it. The vector fields
+   * must not change in between: replacing them, or changing the
+   * modification time of the vector field set or image, makes the
+   * reconstruction throw. Writes to an image buffer that leave its
+   * modification time unchanged are not detected.
+   */
+  itkSetMacro(LazyBasis, bool);
+  itkGetConstMacro(LazyBasis, bool);
+  itkBooleanMacro(LazyBasis);
+
+  /**
+   * \brief Set and get the checkpoint directory.
+   *
+   * When set, Compute() saves the mean, the kernel matrix and each
+   * completed tile of CheckpointInterval rows of the Gram matrix to this
+   * directory. A later Compute() on the same inputs resumes from the last
+   * saved tile. Checkpoints are tagged with a hash of the vector fields,
+   * the points and the kernel, and stale ones are ignored. Each tile is
+   * saved with a checksum, so tiles lost in a crash before they reached
+   * the disk are detected and recomputed. Checkpointing
+   * is only supported for the exact, full resolution Gram matrix.
+   */
+  itkSetStringMacro(CheckpointDirectory);
+  itkGetStringMacro(CheckpointDirectory);
+
+  /**
+   * \brief Set and get the number of Gram matrix rows per checkpoint tile.
+   */
+  itkSetClampMacro(CheckpointInterval, unsigned int, 1, NumericTraits<unsigned int>::max());
+  itkGetConstMacro(CheckpointInterval, unsigned int);
+
+  /**
+   * \brief Return the number of Gram matrix rows restored from the
+   * checkpoint by the last call to Compute().
+   */
+  itkGetConstMacro(CheckpointRestoredRowCount, unsigned int);
+
+  /**
+   * \brief Set and get the sketch size.
+   *
+   * When nonzero, the Gram matrix is approximated from CountSketch
+   * projections of the centered vector fields, and for Kernel PCA of the
+   * kernel-applied centered vector fields, down to SketchSize dimensions.
+   * Each VectorDimCount * PointDim long inner product is then replaced by
+   * a SketchSize long one. The basis is still reconstructed from the
+   * original vector fields. The default of 0 computes the exact Gram
+   * matrix.
+   */
+  itkSetMacro(SketchSize, unsigned int);
+  itkGetConstMacro(SketchSize, unsigned int);
+
+  /**
+   * \brief Set and get the seed of the sketch, so that sketched results
+   * are reproducible.
+   */
+  itkSetMacro(SketchSeed, unsigned int);
+  itkGetConstMacro(SketchSeed, unsigned int);
+
+  /**
+   * \brief Set and get the multiresolution coarsening factor.
+   *
+   * With a factor n > 1, the kernel PCA is solved on every n-th vertex of
+   * the point set and of the vector fields. The sample weights found at
+   * the coarse level are used to reconstruct the basis at full
+   * resolution, with the eigenvalues rescaled by the vertex count ratio.
+   * For Kernel PCA, the ratio is replaced by that of the kernel sums over
+   * all and over the coarse vertices, taken over the kernel rows of the
+   * coarse vertices. Between the ratio for a kernel narrower than the
+   * coarse vertex spacing and its square for a much wider one, this
+   * assumes that the vector fields vary little between neighbouring
+   * coarse vertices. Without MultiresolutionRefinement, the eigenvalues
+   * are only as good as that assumption. The default of 1 solves the full
+   * problem.
+   */
+  itkSetClampMacro(CoarseningFactor, unsigned int, 1, NumericTraits<unsigned int>::max());
+  itkGetConstMacro(CoarseningFactor, unsigned int);
+
+  /**
+   * \brief Set and get the multiresolution refinement pass.
+   *
+   * When on, the coarse solution is refined by a Rayleigh-Ritz step on the
+   * full resolution problem, which gives the exact Rayleigh quotients as
+   * eigenvalues. The kernel is only applied to the ComponentCount basis
+   * vectors, not to every vector field.
+   */
+  itkSetMacro(MultiresolutionRefinement, bool);
+  itkGetConstMacro(MultiresolutionRefinement, bool);
+  itkBooleanMacro(MultiresolutionRefinement);
+
+  /**
+   * \brief Set and get the multiresolution validation.
+   *
+   * When on, the exact full resolution problem is also solved, and the
+   * cosines of the principal angles between the multiresolution and the
+   * exact subspaces are available from GetMultiresolutionSubspaceCosines().
+   * This costs more than the full resolution solution alone.
+   */
+  itkSetMacro(MultiresolutionValidation, bool);
+  itkGetConstMacro(MultiresolutionValidation, bool);
+  itkBooleanMacro(MultiresolutionValidation);
+
   /**
   * \brief Compute the PCA decomposition of the input point set.
       If a Kernel and a Kernel Sigma are set ,
@@ -199,7 +348,83 @@ public:
    */
   itkGetConstReferenceMacro(AveVectorField, MatrixType);
   itkGetConstReferenceMacro(PCAEigenValues, VectorType);
-  itkGetConstObjectMacro(BasisVectors, BasisSetType);
+
+  /** Return the basis vectors, reconstructing any that are pending. The
+   * set is a copy of the basis block, made on the first call after
+   * Compute(), so both are held from then on. */
+  const BasisSetType *
+  GetBasisVectors() const;
+
+  /** Return basis vector k, reconstructing it if it is pending. */
+  MatrixType
+  GetBasisVector(unsigned int k) const;
+
+  /** Return all the basis vectors as one contiguous
+   * ComponentCount x (VectorDimCount * PointDim) block, reconstructing any
+   * that are pending. Row k holds basis vector k in row-major order.
+   * The block owns the basis: the reference stays valid until the next
+   * Compute(). */
+  const MatrixType &
+  GetBasisBlock() const;
+
+  /**
+   * \brief Return an estimate, in bytes, of the peak memory held by the
+   * last call to Compute(), not counting the inputs and the eigensolver
+   * workspace vectors.
+   */
+  itkGetConstMacro(PeakMemoryUsage, SizeValueType);
+
+  /**
+   * \brief Estimate, in bytes, the peak memory usage of Compute() with the
+   * current inputs and settings, before running it. Return 0 when the
+   * vector field set is not set.
+   */
+  SizeValueType
+  EstimatePeakMemoryUsage() const;
+
+  /**
+   * \brief Return, in bytes, the memory held by the results of the last
+   * call to Compute(): the Gram matrix, the mean field, the eigenvalues and
+   * eigenvectors, and the basis vectors reconstructed so far.
+   */
+  SizeValueType
+  GetOutputMemoryUsage() const;
+
+  /** Return the cosines of the principal angles, in descending order,
+   * between the multiresolution and the exact subspaces. Empty unless
+   * MultiresolutionValidation is on. */
+  itkGetConstReferenceMacro(MultiresolutionSubspaceCosines, VectorType);
+
+  /** Types for the resampling replicates. Each replicate is a list of
+   * indices into the vector field set; repeated indices are allowed. */
+  using ReplicateType = std::vector<unsigned int>;
+  using ReplicateSetType = std::vector<ReplicateType>;
+
+  /**
+  * \brief Compute the PCA decomposition of resampled replicates of the
+      vector field set (bootstrap, leave-k-out, ...).
+      The replicate Gram matrices are re-centered submatrices of the Gram
+      matrix of the whole set, so Compute() must be called first and no
+      inner products between vector fields are recomputed. Replicates are
+      solved in parallel. Each replicate must sample more distinct vector
+      fields than ComponentCount.
+  */
+  void
+  ComputeReplicates(const ReplicateSetType & replicates);
+
+  /**
+   * \brief Return the replicate results.
+   *
+   * ReplicateEigenValues holds, for each replicate, the eigenvalues
+   * normalized as in GetPCAEigenValues(). ReplicateSubspaceCosines holds the
+   * cosines of the principal angles between the replicate subspace and the
+   * subspace of the whole set, in descending order.
+   * ReplicateSubspaceSimilarity is the mean of the squared cosines: 1 for
+   * identical subspaces, 0 for orthogonal ones.
+   */
+  itkGetConstObjectMacro(ReplicateEigenValues, ResSetType);
+  itkGetConstObjectMacro(ReplicateSubspaceCosines, ResSetType);
+  itkGetConstReferenceMacro(ReplicateSubspaceSimilarity, VectorType);
 
 protected:
   VectorFieldPCA();
@@ -215,6 +440,133 @@ protected:
   void
   ComputeMomentumSCP();
 
+  /** Compute the average of the vector field set. */
+  void
+  ComputeAveVectorField();
+
+  /** Kernel PCA on a subsampled point set and vector field set. */
+  void
+  MultiresolutionPCA();
+
+  /** Rayleigh-Ritz refinement of the multiresolution solution. */
+  void
+  RefineMultiresolution();
+
+  /** Apply the kernel to each row of fields, a vector field in row-major
+   * order. Return fields unchanged when there is no kernel. */
+  MatrixType
+  ApplyKernel(const MatrixType & fields) const;
+
+  /** Hash of the inputs identifying a checkpoint. */
+  std::uint64_t
+  ComputeInputHash() const;
+
+  /** 64-bit FNV-1a hash of size bytes, continuing hash when given. */
+  static std::uint64_t
+  HashBytes(const void * data, std::size_t size, std::uint64_t hash = 14695981039346656037ULL);
+
+  /** Load the checkpoint matching the inputs, if any. Return the number
+   * of Gram matrix rows restored. */
+  unsigned int
+  ReadCheckpoint(std::uint64_t inputHash, MatrixType & kernelM);
+
+  /** Save the Gram matrix rows [firstRow, lastRow), or start a new
+   * checkpoint when lastRow is 0. */
+  void
+  WriteCheckpoint(std::uint64_t inputHash, const MatrixType & kernelM, unsigned int firstRow, unsigned int lastRow);
+
+  /** Compute Momentum SCP from sketches of the vector fields. */
+  void
+  ComputeMomentumSCPSketch();
+
+  /** Compute Momentum SCP without storing the kernel matrix. */
+  void
+  ComputeMomentumSCPLowMemory();
+
+  /** Record the memory currently in use when it exceeds the peak. */
+  void
+  UpdatePeakMemoryUsage(SizeValueType bytes) const
+  {
+    m_PeakMemoryUsage = std::max(m_PeakMemoryUsage, bytes);
+  }
+
+  static SizeValueType
+  MatrixBytes(const MatrixType & M)
+  {
+    return static_cast<SizeValueType>(M.size()) * sizeof(TPCType);
+  }
+
+  /** Number of kernel matrix rows streamed at a time in LowMemory mode. */
+  static constexpr unsigned int KernelRowBlockSize = 64;
+
+  /** Number of Gram matrix rows computed per tile: the checkpoint interval
+   * when checkpointing. */
+  unsigned int
+  GetGramRowTileSize() const
+  {
+    return m_CheckpointDirectory.empty() ? 16 : m_CheckpointInterval;
+  }
+
+  /** Return the elements of vector field j in row-major order. The
+   * non-const VectorContainer::ElementAt() calls Modified(), which is not
+   * thread safe, so containers shared with worker threads or other
+   * calculators are accessed through const pointers, or through
+   * CastToSTLContainer() for writes. */
+  const TVectorFieldElementType *
+  GetVectorFieldData(unsigned int j) const
+  {
+    if (m_VectorFieldImage)
+    {
+      return m_VectorFieldImage->GetBufferPointer() + static_cast<SizeValueType>(j) * m_VectorDimCount * m_PointDim;
+    }
+    const VectorFieldSetType * vectorFieldSet = m_VectorFieldSet.GetPointer();
+    return vectorFieldSet->ElementAt(j).data_block();
+  }
+
+  /** Return the vector field image if set, or else the vector field set. */
+  const Object *
+  GetVectorFieldInput() const
+  {
+    if (m_VectorFieldImage)
+    {
+      return m_VectorFieldImage.GetPointer();
+    }
+    return m_VectorFieldSet.GetPointer();
+  }
+
+  /** Get the number of vector fields, their vertex count and their point
+   * dimension, from the vector field image if set, or else from the first
+   * field of the set. Return false when there are no vector fields. */
+  bool
+  GetInputSize(SizeValueType & setSize, SizeValueType & vertexCount, SizeValueType & pointDim) const;
+
+  /** Reconstruct the given basis vectors in the basis block. */
+  void
+  ComputeBasis(const std::vector<unsigned int> & components) const;
+
+  /** Reconstruct the basis vectors that have not been reconstructed yet. */
+  void
+  ComputePendingBasis() const;
+
+  /** Estimate the peak memory usage of the Gram matrix computation and of
+   * its eigen-decomposition for n fields of v vertices of dimension d. */
+  SizeValueType
+  EstimateKernelPCAMemoryUsage(SizeValueType n,
+                               SizeValueType v,
+                               SizeValueType d,
+                               bool          lowMemory,
+                               SizeValueType sketchSize) const;
+
+  /** Double-center a Gram matrix in place. */
+  static void
+  DoubleCenter(MatrixType & K);
+
+  /** Eigen-decompose a centered Gram matrix. The count largest eigenvalues
+   * are returned in descending order, with the eigenvectors scaled so
+   * that the corresponding basis vectors have unit norm. */
+  static void
+  EigenDecomposition(const MatrixType & K0, unsigned int count, VectorType & eigenValues, MatrixType & V);
+
 private:
   VectorType m_PCAEigenValues;
 
@@ -223,6 +575,8 @@ private:
   InputPointSetPointer      m_PointSet;
   KernelFunctionPointer     m_KernelFunction;
 
+  typename VectorFieldImageType::ConstPointer m_VectorFieldImage;
+
   // Problem dimensions
   unsigned int m_ComponentCount{ 0 };
   unsigned int m_SetSize{ 0 };
@@ -234,7 +588,43 @@ private:
   MatrixType m_AveVectorField;
   MatrixType m_K;
 
+  // Lazily reconstructed by the const basis accessors
+  mutable MatrixType        m_BasisBlock;
+  mutable std::vector<bool> m_BasisComputed;
+
+  ResSetTypePointer m_ReplicateEigenValues;
+  ResSetTypePointer m_ReplicateSubspaceCosines;
+  VectorType        m_ReplicateSubspaceSimilarity;
+
+  MultiThreaderBase::Pointer m_MultiThreader;
+
+  bool m_LowMemory{ false };
+  bool m_LazyBasis{ false };
+
+  std::string  m_CheckpointDirectory;
+  unsigned int m_CheckpointInterval{ 16 };
+  unsigned int m_CheckpointRestoredRowCount{ 0 };
+
+  // Checksum of the saved mean and kernel matrix, and last row and
+  // checksum of each saved Gram matrix tile
+  std::uint64_t                                       m_CheckpointDataChecksum{ 0 };
+  std::vector<std::pair<unsigned int, std::uint64_t>> m_CheckpointTiles;
+
+  unsigned int m_SketchSize{ 0 };
+  unsigned int m_SketchSeed{ 0 };
+
+  unsigned int m_CoarseningFactor{ 1 };
+  bool         m_MultiresolutionRefinement{ false };
+  bool         m_MultiresolutionValidation{ false };
+  VectorType   m_MultiresolutionSubspaceCosines;
+
+  mutable SizeValueType m_PeakMemoryUsage{ 0 };
+
   bool m_PCACalculated{ false };
+
+  // The vector field input of the last Compute() and its modification time
+  const Object *   m_ComputedInput{ nullptr };
+  ModifiedTimeType m_ComputedInputMTime{ 0 };
 };
 
 } // end namespace itk
@@ -20,8 +20,16 @@
 #define itkVectorFieldPCA_hxx
 
 #include "vnl/algo/vnl_symmetric_eigensystem.h"
+#include "vnl/algo/vnl_svd.h"
 #include "vnl/vnl_c_vector.h"
 #include "itkMath.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+#include "itksys/SystemTools.hxx"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <numeric>
 
 namespace itk
 {
@@ -37,10 +45,1128 @@ VectorFieldPCA<TVectorFieldElementType,
                TPointSetPixelType,
                TPointSetCoordRepType,
                KernelFunctionType,
-               TPointSetType>::VectorFieldPCA()
-  : m_BasisVectors(BasisSetType::New())
+               TPointSetType>::VectorFieldPCA()
+  : m_BasisVectors(BasisSetType::New())
+  , m_ReplicateEigenValues(ResSetType::New())
+  , m_ReplicateSubspaceCosines(ResSetType::New())
+  , m_MultiThreader(MultiThreaderBase::New())
+{}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::Compute()
+{
+  // The results of a previous call are dropped, even if this one fails
+  m_PCACalculated = false;
+  m_BasisVectors->Initialize();
+  m_BasisBlock.clear();
+  m_BasisComputed.clear();
+
+  // Check parameters
+  if (m_VectorFieldSet && m_VectorFieldImage)
+  {
+    itkExceptionMacro("Both a Vector Field Set and a Vector Field Image are specified.");
+    return;
+  }
+
+  SizeValueType setSize, vertexCount, pointDim;
+  if (!this->GetInputSize(setSize, vertexCount, pointDim))
+  {
+    itkExceptionMacro("Vector Field Set not specified.");
+    return;
+  }
+
+  m_SetSize = setSize;
+  if (m_ComponentCount <= 0 || m_ComponentCount > m_SetSize)
+  {
+    itkExceptionMacro("Component Count N must be 0 < N <= VectorFieldSetSize (" << m_SetSize << ").");
+    return;
+  }
+
+  // Get vector/point dim from the first member of the vector set, or from
+  // the image
+  m_VectorDimCount = vertexCount;
+  m_PointDim = pointDim;
+
+  // Check all vector dimensions in the set
+  if (m_VectorFieldSet)
+  {
+    const VectorFieldSetType * vectorFieldSet = m_VectorFieldSet.GetPointer();
+    for (unsigned int i = 1; i < vectorFieldSet->Size(); i++)
+    {
+      const VectorFieldType & thisField = vectorFieldSet->ElementAt(i);
+      if (thisField.rows() != m_VectorDimCount || thisField.cols() != m_PointDim)
+      {
+        itkExceptionMacro("Vector " << i << " dimensions (" << thisField.rows() << "x" << thisField.cols()
+                                    << ") does not match other vector fields dimensions (" << m_VectorDimCount << "x"
+                                    << m_PointDim << ").");
+        return;
+      }
+    }
+  }
+
+  if (m_KernelFunction)
+  {
+    // will try Kernel PCA, so need a point set...
+    if (!m_PointSet)
+    {
+      itkExceptionMacro("KernelFunction is set but no PointSet is available.");
+      return;
+    }
+
+    //  PointSet only necessary for Kernel PCA, but check that it matches if set...
+    if (m_PointSet)
+    {
+      if (m_PointSet->GetNumberOfPoints() != m_VectorDimCount)
+      {
+        itkExceptionMacro("Point Set count (" << m_PointSet->GetNumberOfPoints()
+                                              << ") does not match vector field count (" << m_VectorDimCount << ").");
+        return;
+      }
+    }
+  }
+
+  if (!m_CheckpointDirectory.empty() && (m_LowMemory || m_SketchSize > 0 || m_CoarseningFactor > 1))
+  {
+    itkExceptionMacro("Checkpointing is not supported with LowMemory, SketchSize or CoarseningFactor.");
+    return;
+  }
+
+  m_PeakMemoryUsage = 0;
+  m_CheckpointRestoredRowCount = 0;
+
+  // The lazy basis is reconstructed from these vector fields
+  m_ComputedInput = this->GetVectorFieldInput();
+  m_ComputedInputMTime = m_ComputedInput->GetMTime();
+
+  if (m_CoarseningFactor > 1)
+  {
+    this->MultiresolutionPCA();
+  }
+  else
+  {
+    this->ComputeMomentumSCP();
+    this->KernelPCA();
+  }
+
+  // Save only the desired eigenvalues
+  m_PCAEigenValues = m_PCAEigenValues.extract(m_ComponentCount);
+
+  // Save only the desired eigenvectors
+  m_V0 = m_V0.extract(m_V0.rows(), m_ComponentCount);
+
+  // The basis set is materialized from the basis block on demand
+  m_BasisComputed.assign(m_ComponentCount, false);
+
+  if (!m_LazyBasis)
+  {
+    this->UpdatePeakMemoryUsage(MatrixBytes(m_K) + MatrixBytes(m_V0) + MatrixBytes(m_AveVectorField) +
+                                static_cast<SizeValueType>(m_ComponentCount) * m_VectorDimCount * m_PointDim *
+                                  sizeof(TPCType));
+
+    this->ComputePendingBasis();
+  }
+
+  m_PCAEigenValues /= m_SetSize;
+  m_PCAEigenValues = m_PCAEigenValues.apply(sqrt);
+
+  m_PCACalculated = true;
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+auto
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::GetBasisVectors() const -> const BasisSetType *
+{
+  if (m_PCACalculated && m_BasisVectors->Size() != m_BasisComputed.size())
+  {
+    this->ComputePendingBasis();
+
+    this->UpdatePeakMemoryUsage(MatrixBytes(m_K) + MatrixBytes(m_V0) + MatrixBytes(m_AveVectorField) +
+                                2 * MatrixBytes(m_BasisBlock));
+
+    // The basis block keeps the basis, so that references to it stay
+    // valid, and the set holds a copy
+    m_BasisVectors->Reserve(m_BasisComputed.size());
+    auto & basisVectors = m_BasisVectors->CastToSTLContainer();
+    for (unsigned int k = 0; k < m_BasisComputed.size(); k++)
+    {
+      basisVectors[k].set_size(m_VectorDimCount, m_PointDim);
+      basisVectors[k].copy_in(m_BasisBlock[k]);
+    }
+  }
+
+  return m_BasisVectors.GetPointer();
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+auto
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::GetBasisVector(unsigned int k) const -> MatrixType
+{
+  if (!m_PCACalculated)
+  {
+    itkExceptionMacro("Compute() must be called before GetBasisVector().");
+  }
+  if (k >= m_BasisComputed.size())
+  {
+    itkExceptionMacro("Basis vector " << k << " is out of range (ComponentCount " << m_BasisComputed.size() << ").");
+  }
+
+  if (!m_BasisComputed[k])
+  {
+    this->ComputeBasis(std::vector<unsigned int>(1, k));
+  }
+
+  MatrixType basisVector(m_VectorDimCount, m_PointDim);
+  basisVector.copy_in(m_BasisBlock[k]);
+  return basisVector;
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+auto
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::GetBasisBlock() const -> const MatrixType &
+{
+  if (!m_PCACalculated)
+  {
+    itkExceptionMacro("Compute() must be called before GetBasisBlock().");
+  }
+
+  this->ComputePendingBasis();
+
+  return m_BasisBlock;
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::ComputePendingBasis() const
+{
+  std::vector<unsigned int> pending;
+  for (unsigned int k = 0; k < m_BasisComputed.size(); k++)
+  {
+    if (!m_BasisComputed[k])
+    {
+      pending.push_back(k);
+    }
+  }
+  this->ComputeBasis(pending);
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::ComputeBasis(const std::vector<unsigned int> & components) const
+{
+  if (components.empty())
+  {
+    return;
+  }
+
+  SizeValueType  setSize, vertexCount, pointDim;
+  const Object * input = this->GetVectorFieldInput();
+  if (input != m_ComputedInput || input->GetMTime() != m_ComputedInputMTime ||
+      !this->GetInputSize(setSize, vertexCount, pointDim) || setSize != m_V0.rows() ||
+      vertexCount != m_VectorDimCount || pointDim != m_PointDim)
+  {
+    itkExceptionMacro("The vector fields have changed since Compute(). Call Compute() again to reconstruct the "
+                      "basis vectors.");
+  }
+
+  const unsigned int fieldSize = m_VectorDimCount * m_PointDim;
+  if (m_BasisBlock.empty())
+  {
+    m_BasisBlock.set_size(m_V0.cols(), fieldSize);
+  }
+
+  // Blocked product of the transposed eigenvectors with the vector field
+  // set: each chunk of every field is read once for all the requested
+  // components, and chunks are distributed over the threads.
+  const unsigned int chunkSize = 4096;
+  const unsigned int chunkCount = (fieldSize + chunkSize - 1) / chunkSize;
+
+  m_MultiThreader->ParallelizeArray(
+    0,
+    chunkCount,
+    [&](SizeValueType chunk) {
+      const unsigned int begin = chunk * chunkSize;
+      const unsigned int length = std::min(chunkSize, fieldSize - begin);
+
+      for (const unsigned int k : components)
+      {
+        std::fill_n(m_BasisBlock[k] + begin, length, TPCType(0.0));
+      }
+
+      for (unsigned int j = 0; j < m_V0.rows(); j++)
+      {
+        const TVectorFieldElementType * field = this->GetVectorFieldData(j) + begin;
+        for (const unsigned int k : components)
+        {
+          const TPCType weight = m_V0(j, k);
+          TPCType *     basis = m_BasisBlock[k] + begin;
+          for (unsigned int e = 0; e < length; e++)
+          {
+            basis[e] += weight * TPCType(field[e]);
+          }
+        }
+      }
+    },
+    nullptr);
+
+  for (const unsigned int k : components)
+  {
+    m_BasisComputed[k] = true;
+  }
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::ComputeReplicates(const ReplicateSetType & replicates)
+{
+  if (!m_PCACalculated)
+  {
+    itkExceptionMacro("Compute() must be called before ComputeReplicates().");
+    return;
+  }
+
+  if (m_K.empty())
+  {
+    itkExceptionMacro("The Gram matrix is not available. Turn LowMemory off and use a CoarseningFactor of 1 to "
+                      "compute replicates.");
+    return;
+  }
+
+  for (unsigned int r = 0; r < replicates.size(); r++)
+  {
+    const ReplicateType & replicate = replicates[r];
+    std::vector<bool>     sampled(m_SetSize, false);
+    unsigned int          distinctCount = 0;
+    for (const unsigned int ix : replicate)
+    {
+      if (ix >= m_SetSize)
+      {
+        itkExceptionMacro("Replicate " << r << " index " << ix << " is out of range (SetSize " << m_SetSize
+                                       << ").");
+        return;
+      }
+      if (!sampled[ix])
+      {
+        sampled[ix] = true;
+        distinctCount++;
+      }
+    }
+
+    // The centered Gram matrix of the replicate has a rank of at most one
+    // less than its number of distinct fields
+    if (distinctCount <= m_V0.cols())
+    {
+      itkExceptionMacro("Replicate " << r << " has " << distinctCount
+                                     << " distinct fields, which must be more than Component Count (" << m_V0.cols()
+                                     << ").");
+      return;
+    }
+  }
+
+  const unsigned int replicateCount = replicates.size();
+  const unsigned int componentCount = m_V0.cols();
+
+  // Inner products of every vector field with the basis of the whole set.
+  // The replicate eigenvectors sum to zero, so the centering of the rows
+  // does not matter when projecting the replicate basis onto it.
+  MatrixType KCentered(m_K);
+  DoubleCenter(KCentered);
+  const MatrixType KV0 = KCentered * m_V0;
+  KCentered.clear();
+
+  m_ReplicateEigenValues = ResSetType::New();
+  m_ReplicateEigenValues->Reserve(replicateCount);
+  m_ReplicateSubspaceCosines = ResSetType::New();
+  m_ReplicateSubspaceCosines->Reserve(replicateCount);
+  m_ReplicateSubspaceSimilarity.set_size(replicateCount);
+
+  auto & replicateEigenValues = m_ReplicateEigenValues->CastToSTLContainer();
+  auto & replicateSubspaceCosines = m_ReplicateSubspaceCosines->CastToSTLContainer();
+
+  m_MultiThreader->ParallelizeArray(
+    0,
+    replicateCount,
+    [&](SizeValueType r) {
+      const ReplicateType & replicate = replicates[r];
+      const unsigned int    n = replicate.size();
+
+      // Re-index the Gram matrix of the whole set, then re-center it on
+      // the replicate mean
+      MatrixType K0(n, n);
+      for (unsigned int k = 0; k < n; k++)
+      {
+        for (unsigned int l = 0; l < n; l++)
+        {
+          K0(k, l) = m_K(replicate[k], replicate[l]);
+        }
+      }
+      DoubleCenter(K0);
+
+      VectorType eigenValues;
+      MatrixType V;
+      EigenDecomposition(K0, componentCount, eigenValues, V);
+
+      // Inner products between the replicate and the whole set basis
+      MatrixType KV0Rows(n, componentCount);
+      for (unsigned int k = 0; k < n; k++)
+      {
+        KV0Rows.set_row(k, KV0.get_row(replicate[k]));
+      }
+      const MatrixType cross = V.transpose() * KV0Rows;
+
+      vnl_svd<TPCType> svd(cross);
+      VectorType       cosines(componentCount);
+      TPCType          similarity = 0.0;
+      for (unsigned int k = 0; k < componentCount; k++)
+      {
+        cosines(k) = std::min(TPCType(svd.W(k)), TPCType(1.0));
+        similarity += cosines(k) * cosines(k);
+      }
+
+      eigenValues /= n;
+      for (unsigned int k = 0; k < eigenValues.size(); k++)
+      {
+        eigenValues(k) = std::sqrt(std::max(eigenValues(k), TPCType(0.0)));
+      }
+
+      replicateEigenValues[r] = eigenValues;
+      replicateSubspaceCosines[r] = cosines;
+      m_ReplicateSubspaceSimilarity(r) = similarity / componentCount;
+    },
+    nullptr);
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::MultiresolutionPCA()
+{
+  // Coarse level: every CoarseningFactor-th vertex of the point set and of
+  // the vector fields
+  const unsigned int coarseCount = (m_VectorDimCount + m_CoarseningFactor - 1) / m_CoarseningFactor;
+
+  VectorFieldSetTypePointer coarseFieldSet = VectorFieldSetType::New();
+  coarseFieldSet->Reserve(m_SetSize);
+  for (unsigned int j = 0; j < m_SetSize; j++)
+  {
+    const TVectorFieldElementType * field = this->GetVectorFieldData(j);
+    VectorFieldType &               coarseField = coarseFieldSet->ElementAt(j);
+    coarseField.set_size(coarseCount, m_PointDim);
+    for (unsigned int i = 0; i < coarseCount; i++)
+    {
+      coarseField.set_row(i, field + static_cast<SizeValueType>(i) * m_CoarseningFactor * m_PointDim);
+    }
+  }
+
+  InputPointSetPointer coarsePointSet;
+  if (m_PointSet)
+  {
+    coarsePointSet = InputPointSetType::New();
+    unsigned int i = 0;
+    unsigned int coarseId = 0;
+    for (PointsContainerIterator pIx = m_PointSet->GetPoints()->Begin(); pIx != m_PointSet->GetPoints()->End(); pIx++)
+    {
+      if (i++ % m_CoarseningFactor == 0)
+      {
+        coarsePointSet->SetPoint(coarseId++, pIx.Value());
+      }
+    }
+  }
+
+  Pointer coarse = Self::New();
+  coarse->SetVectorFieldSet(coarseFieldSet);
+  coarse->SetPointSet(coarsePointSet);
+  coarse->SetKernelFunction(m_KernelFunction);
+  coarse->SetComponentCount(m_ComponentCount);
+  coarse->SetLowMemory(m_LowMemory);
+  coarse->SetSketchSize(m_SketchSize);
+  coarse->SetSketchSeed(m_SketchSeed);
+  coarse->SetLazyBasis(true);
+  coarse->SetMultiThreader(m_MultiThreader);
+  coarse->Compute();
+
+  this->ComputeAveVectorField();
+
+  this->UpdatePeakMemoryUsage(coarse->GetPeakMemoryUsage() + MatrixBytes(m_AveVectorField) +
+                              static_cast<SizeValueType>(m_SetSize) * coarseCount * m_PointDim *
+                                sizeof(TVectorFieldElementType));
+
+  // The sample weights carry over to the full resolution, but the Gram
+  // matrix grows with the vertex count. For Kernel PCA it grows with the
+  // sum of the kernel over the vertex pairs instead, which is estimated
+  // from the kernel rows of the coarse vertices: the scale goes from the
+  // ratio, for a kernel narrower than the coarse vertex spacing, to its
+  // square, for a kernel much wider than it.
+  const double ratio = static_cast<double>(m_VectorDimCount) / coarseCount;
+  double       scale = ratio;
+  if (m_KernelFunction)
+  {
+    std::vector<InputPointType> points;
+    points.reserve(m_VectorDimCount);
+    for (PointsContainerIterator pIx = m_PointSet->GetPoints()->Begin(); pIx != m_PointSet->GetPoints()->End(); pIx++)
+    {
+      points.push_back(pIx.Value());
+    }
+
+    std::vector<double> fullSums(coarseCount, 0.0);
+    std::vector<double> coarseSums(coarseCount, 0.0);
+    m_MultiThreader->ParallelizeArray(
+      0,
+      coarseCount,
+      [&](SizeValueType i) {
+        const InputPointType & point = points[i * m_CoarseningFactor];
+        for (unsigned int j = 0; j < m_VectorDimCount; j++)
+        {
+          const double value = m_KernelFunction->Evaluate(point.SquaredEuclideanDistanceTo(points[j]));
+          fullSums[i] += value;
+          if (j % m_CoarseningFactor == 0)
+          {
+            coarseSums[i] += value;
+          }
+        }
+      },
+      nullptr);
+
+    const double coarseSum = std::accumulate(coarseSums.begin(), coarseSums.end(), 0.0);
+    if (coarseSum > 0.0)
+    {
+      scale = ratio * std::accumulate(fullSums.begin(), fullSums.end(), 0.0) / coarseSum;
+    }
+  }
+
+  m_V0 = coarse->m_V0 / TPCType(std::sqrt(scale));
+  m_PCAEigenValues.set_size(m_ComponentCount);
+  for (unsigned int k = 0; k < m_ComponentCount; k++)
+  {
+    m_PCAEigenValues(k) = scale * m_SetSize * coarse->m_PCAEigenValues(k) * coarse->m_PCAEigenValues(k);
+  }
+
+  coarse = nullptr;
+  coarseFieldSet = nullptr;
+
+  // The Gram matrix is only known at the coarse level
+  m_K.clear();
+
+  if (m_MultiresolutionRefinement)
+  {
+    this->RefineMultiresolution();
+  }
+
+  m_MultiresolutionSubspaceCosines.clear();
+  if (m_MultiresolutionValidation)
+  {
+    Pointer exact = Self::New();
+    exact->SetVectorFieldSet(m_VectorFieldSet);
+    exact->SetVectorFieldImage(m_VectorFieldImage);
+    exact->SetPointSet(m_PointSet);
+    exact->SetKernelFunction(m_KernelFunction);
+    exact->SetComponentCount(m_ComponentCount);
+    exact->SetLazyBasis(true);
+    exact->SetMultiThreader(m_MultiThreader);
+    exact->Compute();
+
+    this->UpdatePeakMemoryUsage(exact->GetPeakMemoryUsage());
+
+    // Principal angles between the basis of this solution, orthonormalized
+    // in the metric of the exact Gram matrix, and the exact basis
+    MatrixType KCentered(exact->m_K);
+    DoubleCenter(KCentered);
+    const MatrixType KV0 = KCentered * m_V0;
+    KCentered.clear();
+
+    MatrixType gram = m_V0.transpose() * KV0;
+    gram = (gram + gram.transpose()) * TPCType(0.5);
+    const vnl_symmetric_eigensystem<TPCType> gramEigs(gram);
+
+    // Pseudo-inverse square root: directions of the basis with no energy
+    // in the exact metric, when it is rank deficient, get a zero cosine
+    const TPCType tolerance = 1.0e-10 * std::max(gramEigs.get_eigenvalue(m_ComponentCount - 1), TPCType(0.0));
+    MatrixType    gramInverseSqrt(m_ComponentCount, m_ComponentCount, 0.0);
+    for (unsigned int k = 0; k < m_ComponentCount; k++)
+    {
+      const TPCType eigenValue = gramEigs.get_eigenvalue(k);
+      if (eigenValue > tolerance)
+      {
+        const VectorType eigenVector = gramEigs.get_eigenvector(k);
+        gramInverseSqrt += outer_product(eigenVector, eigenVector) / std::sqrt(eigenValue);
+      }
+    }
+
+    vnl_svd<TPCType> svd(gramInverseSqrt * KV0.transpose() * exact->m_V0);
+    m_MultiresolutionSubspaceCosines.set_size(m_ComponentCount);
+    for (unsigned int k = 0; k < m_ComponentCount; k++)
+    {
+      m_MultiresolutionSubspaceCosines(k) = std::min(TPCType(svd.W(k)), TPCType(1.0));
+    }
+  }
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::RefineMultiresolution()
+{
+  const unsigned int fieldSize = m_VectorDimCount * m_PointDim;
+  const unsigned int componentCount = m_V0.cols();
+  const TPCType *    ave = m_AveVectorField.data_block();
+
+  // Rayleigh-Ritz step on the full resolution problem, restricted to the
+  // span of the coarse eigenvectors. Only the basis vectors need the
+  // kernel, not every vector field.
+  MatrixType U(m_V0);
+  U.normalize_columns();
+
+  MatrixType B(componentCount, fieldSize);
+  B.fill(0.0);
+  m_MultiThreader->ParallelizeArray(
+    0,
+    componentCount,
+    [&](SizeValueType a) {
+      TPCType * basis = B[a];
+      for (unsigned int j = 0; j < m_SetSize; j++)
+      {
+        const TVectorFieldElementType * field = this->GetVectorFieldData(j);
+        const TPCType                   weight = U(j, a);
+        for (unsigned int e = 0; e < fieldSize; e++)
+        {
+          basis[e] += weight * (TPCType(field[e]) - ave[e]);
+        }
+      }
+    },
+    nullptr);
+
+  const MatrixType KB = this->ApplyKernel(B);
+
+  this->UpdatePeakMemoryUsage(MatrixBytes(m_AveVectorField) + MatrixBytes(m_V0) + MatrixBytes(U) + MatrixBytes(B) +
+                              MatrixBytes(KB));
+
+  // Full resolution Gram matrix times the coarse eigenvectors
+  MatrixType KU(m_SetSize, componentCount);
+  m_MultiThreader->ParallelizeArray(
+    0,
+    m_SetSize,
+    [&](SizeValueType j) {
+      const TVectorFieldElementType * field = this->GetVectorFieldData(j);
+      for (unsigned int a = 0; a < componentCount; a++)
+      {
+        const TPCType * kernelBasis = KB[a];
+        TPCType         dot = 0.0;
+        for (unsigned int e = 0; e < fieldSize; e++)
+        {
+          dot += (TPCType(field[e]) - ave[e]) * kernelBasis[e];
+        }
+        KU(j, a) = dot;
+      }
+    },
+    nullptr);
+
+  MatrixType H = U.transpose() * KU;
+  H = (H + H.transpose()) * TPCType(0.5);
+
+  MatrixType Z;
+  EigenDecomposition(H, componentCount, m_PCAEigenValues, Z);
+  m_V0 = U * Z;
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+auto
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::ApplyKernel(const MatrixType & fields) const -> MatrixType
+{
+  if (!m_KernelFunction)
+  {
+    return fields;
+  }
+
+  // Each row of fields holds a vector field in row-major order. The kernel
+  // matrix is evaluated one row at a time and never stored.
+  std::vector<InputPointType> points;
+  points.reserve(m_VectorDimCount);
+  for (PointsContainerIterator pIx = m_PointSet->GetPoints()->Begin(); pIx != m_PointSet->GetPoints()->End(); pIx++)
+  {
+    points.push_back(pIx.Value());
+  }
+
+  MatrixType result(fields.rows(), fields.cols());
+  result.fill(0.0);
+
+  m_MultiThreader->ParallelizeArray(
+    0,
+    m_VectorDimCount,
+    [&](SizeValueType i) {
+      VectorType kernelRow(m_VectorDimCount);
+      for (unsigned int j = 0; j < m_VectorDimCount; j++)
+      {
+        kernelRow(j) = m_KernelFunction->Evaluate(points[i].SquaredEuclideanDistanceTo(points[j]));
+      }
+
+      for (unsigned int a = 0; a < fields.rows(); a++)
+      {
+        const TPCType * field = fields[a];
+        TPCType *       out = result[a] + i * m_PointDim;
+        for (unsigned int j = 0; j < m_VectorDimCount; j++)
+        {
+          for (unsigned int d = 0; d < m_PointDim; d++)
+          {
+            out[d] += kernelRow(j) * field[j * m_PointDim + d];
+          }
+        }
+      }
+    },
+    nullptr);
+
+  return result;
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+bool
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::GetInputSize(SizeValueType & setSize,
+                                            SizeValueType & vertexCount,
+                                            SizeValueType & pointDim) const
+{
+  if (m_VectorFieldImage)
+  {
+    const typename VectorFieldImageType::SizeType size = m_VectorFieldImage->GetBufferedRegion().GetSize();
+    setSize = size[2];
+    vertexCount = size[1];
+    pointDim = size[0];
+    return setSize > 0;
+  }
+
+  if (!m_VectorFieldSet || !m_VectorFieldSet->Size())
+  {
+    return false;
+  }
+
+  const VectorFieldSetType * vectorFieldSet = m_VectorFieldSet.GetPointer();
+  setSize = vectorFieldSet->Size();
+  vertexCount = vectorFieldSet->ElementAt(0).rows();
+  pointDim = vectorFieldSet->ElementAt(0).cols();
+  return true;
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+SizeValueType
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::GetOutputMemoryUsage() const
+{
+  SizeValueType bytes = MatrixBytes(m_K) + MatrixBytes(m_V0) + MatrixBytes(m_AveVectorField) +
+                        MatrixBytes(m_BasisBlock) + static_cast<SizeValueType>(m_PCAEigenValues.size()) * sizeof(TPCType);
+  if (m_BasisVectors)
+  {
+    const BasisSetType * basisVectors = m_BasisVectors.GetPointer();
+    for (unsigned int i = 0; i < basisVectors->Size(); i++)
+    {
+      bytes += static_cast<SizeValueType>(basisVectors->ElementAt(i).size()) * sizeof(TPCType);
+    }
+  }
+  return bytes;
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+SizeValueType
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::EstimatePeakMemoryUsage() const
+{
+  SizeValueType n, v, d;
+  if (!this->GetInputSize(n, v, d))
+  {
+    return 0;
+  }
+
+  // Mirrors the memory accounting of Compute()
+  const SizeValueType k = m_ComponentCount;
+  const SizeValueType aveBytes = v * d * sizeof(TPCType);
+
+  SizeValueType peak = 0;
+  if (m_CoarseningFactor > 1)
+  {
+    const SizeValueType coarseCount = (v + m_CoarseningFactor - 1) / m_CoarseningFactor;
+    peak = this->EstimateKernelPCAMemoryUsage(n, coarseCount, d, m_LowMemory, m_SketchSize) + aveBytes +
+           n * coarseCount * d * sizeof(TVectorFieldElementType);
+    if (m_MultiresolutionRefinement)
+    {
+      peak = std::max(peak, aveBytes + 2 * n * k * sizeof(TPCType) + 2 * k * v * d * sizeof(TPCType));
+    }
+    if (m_MultiresolutionValidation)
+    {
+      peak = std::max(peak, this->EstimateKernelPCAMemoryUsage(n, v, d, false, 0));
+    }
+  }
+  else
+  {
+    peak = this->EstimateKernelPCAMemoryUsage(n, v, d, m_LowMemory, m_SketchSize);
+  }
+
+  if (!m_LazyBasis)
+  {
+    const bool keepsK = !m_LowMemory && m_CoarseningFactor == 1;
+    peak = std::max(peak,
+                    (keepsK ? n * n * sizeof(TPCType) : 0) + n * k * sizeof(TPCType) + aveBytes +
+                      k * v * d * sizeof(TPCType));
+  }
+
+  return peak;
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+SizeValueType
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::EstimateKernelPCAMemoryUsage(SizeValueType n,
+                                                            SizeValueType v,
+                                                            SizeValueType d,
+                                                            bool          lowMemory,
+                                                            SizeValueType sketchSize) const
+{
+  const SizeValueType t = sizeof(TPCType);
+  const SizeValueType f = v * d;
+  const SizeValueType aveBytes = f * t;
+  const SizeValueType gramBytes = n * n * t;
+  const SizeValueType eigenSolverBytes = 2 * n * n * sizeof(double) + gramBytes;
+
+  SizeValueType scp = 0;
+  if (sketchSize > 0)
+  {
+    const SizeValueType sketchBytes = n * sketchSize * t;
+    const SizeValueType tableBytes = f * (sizeof(unsigned int) + t);
+    const SizeValueType productBytes = n * std::min(SizeValueType(256), v) * d * t;
+    scp = m_KernelFunction ? aveBytes + 2 * sketchBytes + std::max(productBytes + tableBytes, 2 * gramBytes)
+                           : aveBytes + 2 * sketchBytes + gramBytes + tableBytes;
+  }
+  else if (lowMemory)
+  {
+    const SizeValueType rowBlockSize = std::min(SizeValueType(KernelRowBlockSize), v);
+    const SizeValueType workUnitCount = m_MultiThreader->GetNumberOfWorkUnits();
+    scp = aveBytes + gramBytes + (m_KernelFunction ? rowBlockSize * (v + (n + workUnitCount) * d) * t : 0);
+  }
+  else
+  {
+    const SizeValueType rowTileSize = std::min(SizeValueType(this->GetGramRowTileSize()), n);
+    const SizeValueType workUnitCount = m_MultiThreader->GetNumberOfWorkUnits();
+    scp = aveBytes + gramBytes + (m_KernelFunction ? v * v * t : 0) + (rowTileSize + 2 * workUnitCount) * f * t;
+  }
+
+  const SizeValueType kernelPCA =
+    lowMemory ? aveBytes + gramBytes + eigenSolverBytes : aveBytes + 2 * gramBytes + eigenSolverBytes;
+
+  return std::max(scp, kernelPCA);
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::ComputeMomentumSCP()
+{
+  this->ComputeAveVectorField();
+
+  if (m_SketchSize > 0)
+  {
+    this->ComputeMomentumSCPSketch();
+    return;
+  }
+
+  if (m_LowMemory)
+  {
+    this->ComputeMomentumSCPLowMemory();
+    return;
+  }
+
+  const unsigned int  fieldSize = m_VectorDimCount * m_PointDim;
+  const TPCType *     ave = m_AveVectorField.data_block();
+  const unsigned int  rowTileSize = std::min(this->GetGramRowTileSize(), m_SetSize);
+  const SizeValueType vertexCount = m_VectorDimCount;
+  this->UpdatePeakMemoryUsage(
+    MatrixBytes(m_AveVectorField) + static_cast<SizeValueType>(m_SetSize) * m_SetSize * sizeof(TPCType) +
+    (m_KernelFunction ? vertexCount * vertexCount * sizeof(TPCType) : 0) +
+    (rowTileSize + 2 * static_cast<SizeValueType>(m_MultiThreader->GetNumberOfWorkUnits())) * fieldSize *
+      sizeof(TPCType));
+
+  MatrixType kernelM;
+  if (m_KernelFunction)
+  {
+    kernelM.set_size(m_VectorDimCount, m_VectorDimCount);
+  }
+  m_K.set_size(m_SetSize, m_SetSize);
+
+  // Resume from the last checkpoint, if any
+  const bool    checkpointing = !m_CheckpointDirectory.empty();
+  std::uint64_t inputHash = 0;
+  unsigned int  firstRow = 0;
+  if (checkpointing)
+  {
+    inputHash = this->ComputeInputHash();
+    firstRow = this->ReadCheckpoint(inputHash, kernelM);
+    m_CheckpointRestoredRowCount = firstRow;
+  }
+
+  // Check whether we're doing kernel PCA
+  if (!m_KernelFunction.IsNull() && firstRow == 0)
+  {
+    std::vector<InputPointType> points;
+    points.reserve(m_VectorDimCount);
+    for (PointsContainerIterator pIx = m_PointSet->GetPoints()->Begin(); pIx != m_PointSet->GetPoints()->End(); pIx++)
+    {
+      points.push_back(pIx.Value());
+    }
+
+    m_MultiThreader->ParallelizeArray(
+      0,
+      m_VectorDimCount,
+      [&](SizeValueType i) {
+        for (unsigned int j = 0; j < m_VectorDimCount; j++)
+        {
+          kernelM(i, j) = m_KernelFunction->Evaluate(points[i].SquaredEuclideanDistanceTo(points[j]));
+        }
+      },
+      nullptr);
+  }
+
+  if (checkpointing && firstRow == 0)
+  {
+    this->WriteCheckpoint(inputHash, kernelM, 0, 0);
+  }
+
+  // The Gram matrix is computed a tile of rows at a time. Each vector
+  // field l is centered and kernel-applied once per tile, for all the rows
+  // k <= l of the tile, and the fields are distributed over the threads.
+  MatrixType centeredTile(rowTileSize, fieldSize);
+  for (unsigned int tileFirstRow = firstRow; tileFirstRow < m_SetSize; tileFirstRow += rowTileSize)
+  {
+    const unsigned int tileLastRow = std::min(tileFirstRow + rowTileSize, m_SetSize);
+
+    for (unsigned int k = tileFirstRow; k < tileLastRow; k++)
+    {
+      const TVectorFieldElementType * alphaK = this->GetVectorFieldData(k);
+      TPCType *                       centeredK = centeredTile[k - tileFirstRow];
+      for (unsigned int e = 0; e < fieldSize; e++)
+      {
+        centeredK[e] = TPCType(alphaK[e]) - ave[e];
+      }
+    }
+
+    m_MultiThreader->ParallelizeArray(
+      tileFirstRow,
+      m_SetSize,
+      [&](SizeValueType l) {
+        const TVectorFieldElementType * alphaL = this->GetVectorFieldData(l);
+        MatrixType                      centeredL(m_VectorDimCount, m_PointDim);
+        for (unsigned int e = 0; e < fieldSize; e++)
+        {
+          centeredL.data_block()[e] = TPCType(alphaL[e]) - ave[e];
+        }
+
+        MatrixType      kernelL;
+        const TPCType * tmpA = centeredL.data_block();
+        if (m_KernelFunction)
+        {
+          kernelL = kernelM * centeredL;
+          tmpA = kernelL.data_block();
+        }
+
+        const unsigned int lastRow = std::min<SizeValueType>(tileLastRow, l + 1);
+        for (unsigned int k = tileFirstRow; k < lastRow; k++)
+        {
+          m_K(k, l) = vnl_c_vector<TPCType>::dot_product(tmpA, centeredTile[k - tileFirstRow], fieldSize);
+          m_K(l, k) = m_K(k, l);
+        }
+      },
+      nullptr);
+
+    if (checkpointing)
+    {
+      this->WriteCheckpoint(inputHash, kernelM, tileFirstRow, tileLastRow);
+    }
+  }
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+std::uint64_t
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::ComputeInputHash() const
+{
+  // 64-bit FNV-1a hash of the problem dimensions, the vector fields, the
+  // points and a few kernel values
+  const unsigned int dimensions[] = { m_SetSize, m_VectorDimCount, m_PointDim };
+  std::uint64_t      hash = HashBytes(dimensions, sizeof(dimensions));
+  auto               hashBytes = [&hash](const void * data, std::size_t size) { hash = HashBytes(data, size, hash); };
 
-{}
+  for (unsigned int j = 0; j < m_SetSize; j++)
+  {
+    hashBytes(this->GetVectorFieldData(j),
+              static_cast<std::size_t>(m_VectorDimCount) * m_PointDim * sizeof(TVectorFieldElementType));
+  }
+
+  if (m_KernelFunction)
+  {
+    for (PointsContainerIterator pIx = m_PointSet->GetPoints()->Begin(); pIx != m_PointSet->GetPoints()->End(); pIx++)
+    {
+      const InputPointType & point = pIx.Value();
+      hashBytes(point.GetDataPointer(), sizeof(point));
+    }
+
+    // The kernel parameters are not accessible through the base class, so
+    // the kernel is identified by its values at a few distances
+    for (const TPointSetCoordRepType squaredDistance : { 0.0, 0.25, 1.0, 4.0, 16.0, 64.0, 256.0 })
+    {
+      const TPointSetCoordRepType value = m_KernelFunction->Evaluate(squaredDistance);
+      hashBytes(&value, sizeof(value));
+    }
+  }
+
+  return hash;
+}
 
 template <typename TVectorFieldElementType,
           typename TPCType,
@@ -48,99 +1174,230 @@ template <typename TVectorFieldElementType,
           typename TPointSetCoordRepType,
           typename KernelFunctionType,
           class TPointSetType>
-void
+std::uint64_t
 VectorFieldPCA<TVectorFieldElementType,
                TPCType,
                TPointSetPixelType,
                TPointSetCoordRepType,
                KernelFunctionType,
-               TPointSetType>::Compute()
+               TPointSetType>::HashBytes(const void * data, std::size_t size, std::uint64_t hash)
 {
-  // Check parameters
-  if (!m_VectorFieldSet || !m_VectorFieldSet->Size())
+  const auto * bytes = static_cast<const unsigned char *>(data);
+  for (std::size_t i = 0; i < size; i++)
   {
-    itkExceptionMacro("Vector Field Set not specified.");
-    return;
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
   }
+  return hash;
+}
 
-  m_SetSize = m_VectorFieldSet->Size();
-  if (m_ComponentCount <= 0 || m_ComponentCount > m_SetSize)
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+unsigned int
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::ReadCheckpoint(std::uint64_t inputHash, MatrixType & kernelM)
+{
+  m_CheckpointTiles.clear();
+
+  const std::string headerFileName = m_CheckpointDirectory + "/checkpoint.header";
+  std::ifstream     header(headerFileName.c_str(), std::ios::binary);
+  if (!header)
   {
-    itkExceptionMacro("Component Count N must be 0 < N <= VectorFieldSetSize (" << m_VectorFieldSet->Size() << ").");
-    return;
+    return 0;
   }
 
-  // Get vector/point dim from the first member of the vector set
+  char          magic[8];
+  std::uint64_t hash = 0;
+  unsigned int  dimensions[4];
+  std::uint64_t dataChecksum = 0;
+  unsigned int  tileCount = 0;
+  header.read(magic, sizeof(magic));
+  header.read(reinterpret_cast<char *>(&hash), sizeof(hash));
+  header.read(reinterpret_cast<char *>(dimensions), sizeof(dimensions));
+  header.read(reinterpret_cast<char *>(&dataChecksum), sizeof(dataChecksum));
+  header.read(reinterpret_cast<char *>(&tileCount), sizeof(tileCount));
 
-  VectorFieldType & firstField = m_VectorFieldSet->ElementAt(0);
-  m_VectorDimCount = firstField.rows();
-  m_PointDim = firstField.cols();
+  if (!header || std::memcmp(magic, "VFPCACK2", sizeof(magic)) != 0 || hash != inputHash ||
+      dimensions[0] != m_SetSize || dimensions[1] != m_VectorDimCount || dimensions[2] != m_PointDim ||
+      dimensions[3] != sizeof(TPCType) || tileCount > m_SetSize)
+  {
+    itkWarningMacro("Ignoring stale or invalid checkpoint in " << m_CheckpointDirectory << ".");
+    return 0;
+  }
 
-  // Check all vector dimensions in the set
-  for (unsigned int i = 1; i < m_VectorFieldSet->Size(); i++)
+  std::vector<std::pair<unsigned int, std::uint64_t>> tiles(tileCount);
+  for (auto & tile : tiles)
   {
-    VectorFieldType & thisField = m_VectorFieldSet->ElementAt(i);
-    if (thisField.rows() != m_VectorDimCount || thisField.cols() != m_PointDim)
-    {
-      itkExceptionMacro("Vector " << i << " dimensions (" << thisField.rows() << "x" << thisField.cols()
-                                  << ") does not match other vector fields dimensions (" << m_VectorDimCount << "x"
-                                  << m_PointDim << ").");
-      return;
-    }
+    header.read(reinterpret_cast<char *>(&tile.first), sizeof(tile.first));
+    header.read(reinterpret_cast<char *>(&tile.second), sizeof(tile.second));
   }
 
+  std::ifstream mean((m_CheckpointDirectory + "/mean.bin").c_str(), std::ios::binary);
+  mean.read(reinterpret_cast<char *>(m_AveVectorField.data_block()), MatrixBytes(m_AveVectorField));
+
+  std::ifstream kernel((m_CheckpointDirectory + "/kernel.bin").c_str(), std::ios::binary);
   if (m_KernelFunction)
   {
-    // will try Kernel PCA, so need a point set...
-    if (!m_PointSet)
+    kernel.read(reinterpret_cast<char *>(kernelM.data_block()), MatrixBytes(kernelM));
+  }
+
+  std::uint64_t checksum = HashBytes(m_AveVectorField.data_block(), MatrixBytes(m_AveVectorField));
+  if (m_KernelFunction)
+  {
+    checksum = HashBytes(kernelM.data_block(), MatrixBytes(kernelM), checksum);
+  }
+
+  if (!header || !mean || (m_KernelFunction && !kernel) || checksum != dataChecksum)
+  {
+    itkWarningMacro("Ignoring incomplete checkpoint in " << m_CheckpointDirectory << ".");
+    this->ComputeAveVectorField();
+    return 0;
+  }
+
+  // Restore the tiles up to the first one that did not reach the disk
+  std::ifstream gram((m_CheckpointDirectory + "/gram.bin").c_str(), std::ios::binary);
+  unsigned int  completedRows = 0;
+  for (const auto & tile : tiles)
+  {
+    if (tile.first <= completedRows || tile.first > m_SetSize)
     {
-      itkExceptionMacro("KernelFunction is set but no PointSet is available.");
-      return;
+      break;
     }
 
-    //  PointSet only necessary for Kernel PCA, but check that it matches if set...
-    if (m_PointSet)
+    const std::streamsize tileBytes =
+      static_cast<std::streamsize>(tile.first - completedRows) * m_SetSize * sizeof(TPCType);
+    gram.seekg(static_cast<std::streamoff>(completedRows) * m_SetSize * sizeof(TPCType));
+    gram.read(reinterpret_cast<char *>(m_K[completedRows]), tileBytes);
+    if (!gram || HashBytes(m_K[completedRows], tileBytes) != tile.second)
     {
-      if (m_PointSet->GetNumberOfPoints() != m_VectorDimCount)
-      {
-        itkExceptionMacro("Point Set count (" << m_PointSet->GetNumberOfPoints()
-                                              << ") does not match vector field count (" << m_VectorDimCount << ").");
-        return;
-      }
+      itkWarningMacro("Checkpoint in " << m_CheckpointDirectory << " is corrupt after row " << completedRows
+                                       << ", resuming from there.");
+      break;
     }
+
+    m_CheckpointTiles.push_back(tile);
+    completedRows = tile.first;
   }
+  m_CheckpointDataChecksum = dataChecksum;
 
-  this->ComputeMomentumSCP();
-  this->KernelPCA();
+  // Rows are saved whole, restore the symmetric part
+  for (unsigned int k = 0; k < completedRows; k++)
+  {
+    for (unsigned int l = k + 1; l < m_SetSize; l++)
+    {
+      m_K(l, k) = m_K(k, l);
+    }
+  }
 
-  // Save only the desired eigenvalues
-  m_PCAEigenValues = m_PCAEigenValues.extract(m_ComponentCount);
+  return completedRows;
+}
 
-  // Save only the desired eigenvectors
-  m_V0 = m_V0.extract(m_V0.rows(), m_ComponentCount);
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::WriteCheckpoint(std::uint64_t      inputHash,
+                                               const MatrixType & kernelM,
+                                               unsigned int       firstRow,
+                                               unsigned int       lastRow)
+{
+  const std::string gramFileName = m_CheckpointDirectory + "/gram.bin";
 
-  m_BasisVectors->Reserve(m_ComponentCount);
-  for (unsigned int k = 0; k < m_ComponentCount; k++)
+  if (lastRow == 0)
   {
-    MatrixType      basisVector(m_VectorDimCount, m_PointDim);
-    VectorFieldType accum(m_VectorDimCount, m_PointDim);
-    accum = 0.0;
-    basisVector = 0.0;
-    for (unsigned int j = 0; j < m_SetSize; j++)
+    // New checkpoint: save the mean and the kernel matrix, and start an
+    // empty Gram matrix file
+    if (!itksys::SystemTools::MakeDirectory(m_CheckpointDirectory))
     {
-      vnl_c_vector<TVectorFieldElementType>::saxpy(
-        m_V0(j, k), (m_VectorFieldSet->ElementAt(j)).data_block(), accum.data_block(), accum.size());
+      itkExceptionMacro("Cannot create checkpoint directory " << m_CheckpointDirectory << ".");
     }
 
-    for (unsigned int i = 0; i < accum.size(); ++i)
-      basisVector.begin()[i] = TPCType(accum.begin()[i]);
-    m_BasisVectors->SetElement(k, basisVector);
+    std::ofstream mean((m_CheckpointDirectory + "/mean.bin").c_str(), std::ios::binary | std::ios::trunc);
+    mean.write(reinterpret_cast<const char *>(m_AveVectorField.data_block()), MatrixBytes(m_AveVectorField));
+    m_CheckpointDataChecksum = HashBytes(m_AveVectorField.data_block(), MatrixBytes(m_AveVectorField));
+
+    std::ofstream kernel((m_CheckpointDirectory + "/kernel.bin").c_str(), std::ios::binary | std::ios::trunc);
+    if (m_KernelFunction)
+    {
+      kernel.write(reinterpret_cast<const char *>(kernelM.data_block()), MatrixBytes(kernelM));
+      m_CheckpointDataChecksum = HashBytes(kernelM.data_block(), MatrixBytes(kernelM), m_CheckpointDataChecksum);
+    }
+
+    std::ofstream gram(gramFileName.c_str(), std::ios::binary | std::ios::trunc);
+
+    if (!mean || !kernel || !gram)
+    {
+      itkExceptionMacro("Cannot write checkpoint in " << m_CheckpointDirectory << ".");
+    }
+
+    m_CheckpointTiles.clear();
   }
+  else
+  {
+    // Save the rows of the tile in place. Flushing does not guarantee that
+    // they reach the disk before the header, so the header holds a
+    // checksum of each tile.
+    const std::streamsize tileBytes = static_cast<std::streamsize>(lastRow - firstRow) * m_SetSize * sizeof(TPCType);
 
-  m_PCAEigenValues /= m_SetSize;
-  m_PCAEigenValues = m_PCAEigenValues.apply(sqrt);
+    std::fstream gram(gramFileName.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+    gram.seekp(static_cast<std::streamoff>(firstRow) * m_SetSize * sizeof(TPCType));
+    gram.write(reinterpret_cast<const char *>(m_K[firstRow]), tileBytes);
+    gram.flush();
 
-  m_PCACalculated = true;
+    if (!gram)
+    {
+      itkExceptionMacro("Cannot write checkpoint in " << m_CheckpointDirectory << ".");
+    }
+
+    m_CheckpointTiles.emplace_back(lastRow, HashBytes(m_K[firstRow], tileBytes));
+  }
+
+  // The header is replaced atomically, so that it always describes a
+  // consistent state
+  const std::string headerFileName = m_CheckpointDirectory + "/checkpoint.header";
+  const std::string tmpFileName = headerFileName + ".tmp";
+  {
+    const unsigned int dimensions[4] = { m_SetSize, m_VectorDimCount, m_PointDim, sizeof(TPCType) };
+    const unsigned int tileCount = m_CheckpointTiles.size();
+
+    std::ofstream header(tmpFileName.c_str(), std::ios::binary | std::ios::trunc);
+    header.write("VFPCACK2", 8);
+    header.write(reinterpret_cast<const char *>(&inputHash), sizeof(inputHash));
+    header.write(reinterpret_cast<const char *>(dimensions), sizeof(dimensions));
+    header.write(reinterpret_cast<const char *>(&m_CheckpointDataChecksum), sizeof(m_CheckpointDataChecksum));
+    header.write(reinterpret_cast<const char *>(&tileCount), sizeof(tileCount));
+    for (const auto & tile : m_CheckpointTiles)
+    {
+      header.write(reinterpret_cast<const char *>(&tile.first), sizeof(tile.first));
+      header.write(reinterpret_cast<const char *>(&tile.second), sizeof(tile.second));
+    }
+    header.flush();
+
+    if (!header)
+    {
+      itkExceptionMacro("Cannot write checkpoint in " << m_CheckpointDirectory << ".");
+    }
+  }
+
+  if (!itksys::SystemTools::RenameFile(tmpFileName, headerFileName))
+  {
+    itkExceptionMacro("Cannot write checkpoint in " << m_CheckpointDirectory << ".");
+  }
 }
 
 template <typename TVectorFieldElementType,
@@ -155,7 +1412,7 @@ VectorFieldPCA<TVectorFieldElementType,
                TPointSetPixelType,
                TPointSetCoordRepType,
                KernelFunctionType,
-               TPointSetType>::ComputeMomentumSCP()
+               TPointSetType>::ComputeAveVectorField()
 {
   VectorFieldType accum;
   accum.set_size(m_VectorDimCount, m_PointDim);
@@ -164,7 +1421,11 @@ VectorFieldPCA<TVectorFieldElementType,
   // Determine the average of the vector field over the set
   for (unsigned k = 0; k < m_SetSize; k++)
   {
-    accum += m_VectorFieldSet->ElementAt(k);
+    const TVectorFieldElementType * field = this->GetVectorFieldData(k);
+    for (unsigned int i = 0; i < accum.size(); ++i)
+    {
+      accum.data_block()[i] += field[i];
+    }
   }
   accum /= (double)m_SetSize;
 
@@ -172,56 +1433,266 @@ VectorFieldPCA<TVectorFieldElementType,
 
   for (unsigned int i = 0; i < accum.size(); ++i)
     m_AveVectorField.begin()[i] = TPCType(accum.begin()[i]);
+}
 
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::ComputeMomentumSCPSketch()
+{
+  const unsigned int fieldSize = m_VectorDimCount * m_PointDim;
+  const TPCType *    ave = m_AveVectorField.data_block();
 
-  MatrixType kernelM(m_VectorDimCount, m_VectorDimCount);
+  // CountSketch: each field element is added, with a random sign, to one
+  // random coordinate of the sketch
+  using GeneratorType = Statistics::MersenneTwisterRandomVariateGenerator;
+  GeneratorType::Pointer generator = GeneratorType::New();
+  generator->SetSeed(m_SketchSeed);
 
-  // Check whether we're doing kernel PCA
-  if (!m_KernelFunction.IsNull())
+  std::vector<unsigned int> sketchIndex(fieldSize);
+  std::vector<TPCType>      sketchSign(fieldSize);
+  for (unsigned int e = 0; e < fieldSize; e++)
   {
-    unsigned k1, l1;
-    k1 = 0;
-    for (PointsContainerIterator kIx = m_PointSet->GetPoints()->Begin(); kIx != m_PointSet->GetPoints()->End(); kIx++)
-    {
-      l1 = 0;
-      for (PointsContainerIterator lIx = m_PointSet->GetPoints()->Begin(); lIx != m_PointSet->GetPoints()->End(); lIx++)
+    sketchIndex[e] = generator->GetIntegerVariate(m_SketchSize - 1);
+    sketchSign[e] = generator->GetIntegerVariate(1) ? 1.0 : -1.0;
+  }
+
+  MatrixType sketches(m_SetSize, m_SketchSize);
+  sketches.fill(0.0);
+
+  m_MultiThreader->ParallelizeArray(
+    0,
+    m_SetSize,
+    [&](SizeValueType j) {
+      const TVectorFieldElementType * field = this->GetVectorFieldData(j);
+      TPCType *                       sketch = sketches[j];
+      for (unsigned int e = 0; e < fieldSize; e++)
       {
-        kernelM(k1, l1) = m_KernelFunction->Evaluate((kIx.Value()).SquaredEuclideanDistanceTo(lIx.Value()));
-        kernelM(l1, k1) = kernelM(k1, l1);
-        l1++;
+        sketch[sketchIndex[e]] += sketchSign[e] * (TPCType(field[e]) - ave[e]);
       }
-      k1++;
-    }
+    },
+    nullptr);
+
+  if (!m_KernelFunction)
+  {
+    this->UpdatePeakMemoryUsage(MatrixBytes(m_AveVectorField) + 2 * MatrixBytes(sketches) +
+                                static_cast<SizeValueType>(m_SetSize) * m_SetSize * sizeof(TPCType) +
+                                fieldSize * (sizeof(unsigned int) + sizeof(TPCType)));
+
+    m_K = sketches * sketches.transpose();
+    return;
+  }
+
+  // For Kernel PCA, the kernel-applied fields are sketched as well. The
+  // kernel matrix is evaluated once, a block of rows at a time: the rows
+  // of a block are applied to every field, then each field adds the
+  // products to its own sketch.
+  std::vector<InputPointType> points;
+  points.reserve(m_VectorDimCount);
+  for (PointsContainerIterator pIx = m_PointSet->GetPoints()->Begin(); pIx != m_PointSet->GetPoints()->End(); pIx++)
+  {
+    points.push_back(pIx.Value());
+  }
+
+  MatrixType kernelSketches(m_SetSize, m_SketchSize);
+  kernelSketches.fill(0.0);
+
+  const unsigned int blockSize = std::min(256u, m_VectorDimCount);
+  MatrixType         products(m_SetSize, blockSize * m_PointDim);
+
+  this->UpdatePeakMemoryUsage(MatrixBytes(m_AveVectorField) + 2 * MatrixBytes(sketches) + MatrixBytes(products) +
+                              fieldSize * (sizeof(unsigned int) + sizeof(TPCType)));
+
+  for (unsigned int firstRow = 0; firstRow < m_VectorDimCount; firstRow += blockSize)
+  {
+    const unsigned int rowCount = std::min(blockSize, m_VectorDimCount - firstRow);
+
+    m_MultiThreader->ParallelizeArray(
+      0,
+      rowCount,
+      [&](SizeValueType r) {
+        const unsigned int i = firstRow + r;
+        VectorType         kernelRow(m_VectorDimCount);
+        for (unsigned int j = 0; j < m_VectorDimCount; j++)
+        {
+          kernelRow(j) = m_KernelFunction->Evaluate(points[i].SquaredEuclideanDistanceTo(points[j]));
+        }
+
+        for (unsigned int l = 0; l < m_SetSize; l++)
+        {
+          const TVectorFieldElementType * field = this->GetVectorFieldData(l);
+          TPCType *                       product = products[l] + r * m_PointDim;
+          std::fill_n(product, m_PointDim, TPCType(0.0));
+          for (unsigned int j = 0; j < m_VectorDimCount; j++)
+          {
+            for (unsigned int d = 0; d < m_PointDim; d++)
+            {
+              const unsigned int e = j * m_PointDim + d;
+              product[d] += kernelRow(j) * (TPCType(field[e]) - ave[e]);
+            }
+          }
+        }
+      },
+      nullptr);
+
+    const unsigned int firstElement = firstRow * m_PointDim;
+    const unsigned int elementCount = rowCount * m_PointDim;
+    m_MultiThreader->ParallelizeArray(
+      0,
+      m_SetSize,
+      [&](SizeValueType l) {
+        const TPCType * product = products[l];
+        TPCType *       sketch = kernelSketches[l];
+        for (unsigned int e = 0; e < elementCount; e++)
+        {
+          sketch[sketchIndex[firstElement + e]] += sketchSign[firstElement + e] * product[e];
+        }
+      },
+      nullptr);
   }
 
+  this->UpdatePeakMemoryUsage(MatrixBytes(m_AveVectorField) + 2 * MatrixBytes(sketches) +
+                              2 * static_cast<SizeValueType>(m_SetSize) * m_SetSize * sizeof(TPCType));
+
+  m_K = sketches * kernelSketches.transpose();
+  m_K = (m_K + m_K.transpose()) * TPCType(0.5);
+}
+
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::ComputeMomentumSCPLowMemory()
+{
+  const unsigned int fieldSize = m_VectorDimCount * m_PointDim;
+  const TPCType *    ave = m_AveVectorField.data_block();
+
   m_K.set_size(m_SetSize, m_SetSize);
-  MatrixType alphaK(m_VectorDimCount, m_PointDim);
-  MatrixType alphaL(m_VectorDimCount, m_PointDim);
-  MatrixType tmpA;
-  for (unsigned k = 0; k < m_SetSize; k++)
+  m_K.fill(0.0);
+
+  if (m_KernelFunction)
   {
-    for (unsigned l = k; l < m_SetSize; l++)
+    // The kernel matrix is streamed a block of rows at a time instead of
+    // being stored. For kernel rows i of the block, kernelProducts(l, :)
+    // holds rows i of kernelM * (alphaL - ave), which are dotted with rows
+    // i of every (alphaK - ave).
+    const unsigned int rowBlockSize = std::min(KernelRowBlockSize, m_VectorDimCount);
+    MatrixType         kernelRows(rowBlockSize, m_VectorDimCount);
+    MatrixType         kernelProducts(m_SetSize, rowBlockSize * m_PointDim);
+
+    this->UpdatePeakMemoryUsage(MatrixBytes(m_AveVectorField) + MatrixBytes(m_K) + MatrixBytes(kernelRows) +
+                                MatrixBytes(kernelProducts) +
+                                static_cast<SizeValueType>(m_MultiThreader->GetNumberOfWorkUnits()) * rowBlockSize *
+                                  m_PointDim * sizeof(TPCType));
+
+    std::vector<InputPointType> points;
+    points.reserve(m_VectorDimCount);
+    for (PointsContainerIterator pIx = m_PointSet->GetPoints()->Begin(); pIx != m_PointSet->GetPoints()->End(); pIx++)
     {
-      for (unsigned int i = 0; i < alphaK.size(); ++i)
-      {
-        alphaK.begin()[i] = TPCType(m_VectorFieldSet->ElementAt(k).begin()[i]);
-      }
-      for (unsigned int i = 0; i < alphaL.size(); ++i)
-      {
-        alphaL.begin()[i] = TPCType(m_VectorFieldSet->ElementAt(l).begin()[i]);
-      }
+      points.push_back(pIx.Value());
+    }
 
-      if (m_KernelFunction)
-      {
-        tmpA = kernelM * (alphaL - m_AveVectorField);
-      }
-      else
-      {
-        tmpA = alphaL - m_AveVectorField;
-      }
+    for (unsigned int rowBegin = 0; rowBegin < m_VectorDimCount; rowBegin += rowBlockSize)
+    {
+      const unsigned int rowCount = std::min(rowBlockSize, m_VectorDimCount - rowBegin);
+      const unsigned int blockSize = rowCount * m_PointDim;
+
+      m_MultiThreader->ParallelizeArray(
+        0,
+        rowCount,
+        [&](SizeValueType r) {
+          for (unsigned int j = 0; j < m_VectorDimCount; j++)
+          {
+            kernelRows(r, j) = m_KernelFunction->Evaluate(points[rowBegin + r].SquaredEuclideanDistanceTo(points[j]));
+          }
+        },
+        nullptr);
+
+      m_MultiThreader->ParallelizeArray(
+        0,
+        m_SetSize,
+        [&](SizeValueType l) {
+          const TVectorFieldElementType * alphaL = this->GetVectorFieldData(l);
+          TPCType *                       product = kernelProducts[l];
+          std::fill_n(product, blockSize, TPCType(0.0));
+          for (unsigned int j = 0; j < m_VectorDimCount; j++)
+          {
+            for (unsigned int d = 0; d < m_PointDim; d++)
+            {
+              const unsigned int e = j * m_PointDim + d;
+              const TPCType      centered = TPCType(alphaL[e]) - ave[e];
+              for (unsigned int r = 0; r < rowCount; r++)
+              {
+                product[r * m_PointDim + d] += kernelRows(r, j) * centered;
+              }
+            }
+          }
+        },
+        nullptr);
+
+      m_MultiThreader->ParallelizeArray(
+        0,
+        m_SetSize,
+        [&](SizeValueType k) {
+          const TVectorFieldElementType * alphaK = this->GetVectorFieldData(k) + rowBegin * m_PointDim;
+          const TPCType *                 aveRows = ave + rowBegin * m_PointDim;
+          VectorType                      centeredK(blockSize);
+          for (unsigned int e = 0; e < blockSize; e++)
+          {
+            centeredK(e) = TPCType(alphaK[e]) - aveRows[e];
+          }
+          for (unsigned int l = k; l < m_SetSize; l++)
+          {
+            m_K(k, l) += vnl_c_vector<TPCType>::dot_product(centeredK.data_block(), kernelProducts[l], blockSize);
+          }
+        },
+        nullptr);
+    }
+  }
+  else
+  {
+    this->UpdatePeakMemoryUsage(MatrixBytes(m_AveVectorField) + MatrixBytes(m_K));
+
+    m_MultiThreader->ParallelizeArray(
+      0,
+      m_SetSize,
+      [&](SizeValueType k) {
+        const TVectorFieldElementType * alphaK = this->GetVectorFieldData(k);
+        for (unsigned int l = k; l < m_SetSize; l++)
+        {
+          const TVectorFieldElementType * alphaL = this->GetVectorFieldData(l);
+          TPCType                         dot = 0.0;
+          for (unsigned int e = 0; e < fieldSize; e++)
+          {
+            dot += (TPCType(alphaK[e]) - ave[e]) * (TPCType(alphaL[e]) - ave[e]);
+          }
+          m_K(k, l) = dot;
+        }
+      },
+      nullptr);
+  }
 
-      MatrixType tmpB = alphaK - m_AveVectorField;
-      m_K(k, l) = vnl_c_vector<TPCType>::dot_product(tmpA.data_block(), tmpB.data_block(), tmpA.size());
+  for (unsigned int k = 0; k < m_SetSize; k++)
+  {
+    for (unsigned int l = k + 1; l < m_SetSize; l++)
+    {
       m_K(l, k) = m_K(k, l);
     }
   }
@@ -241,38 +1712,102 @@ VectorFieldPCA<TVectorFieldElementType,
                KernelFunctionType,
                TPointSetType>::KernelPCA()
 {
-  VectorType rowMeans(m_SetSize);
+  // The eigensolver holds a working copy of the matrix and the full
+  // eigenvector matrix.
+  const SizeValueType eigenSolverBytes =
+    2 * static_cast<SizeValueType>(m_SetSize) * m_SetSize * sizeof(double) + MatrixBytes(m_K);
 
-  for (unsigned int k = 0; k < m_SetSize; k++)
+  if (m_LowMemory)
+  {
+    // Center in place, keep only the requested eigenvectors and release
+    // the Gram matrix as soon as it is consumed
+    DoubleCenter(m_K);
+
+    this->UpdatePeakMemoryUsage(MatrixBytes(m_AveVectorField) + MatrixBytes(m_K) + eigenSolverBytes);
+
+    EigenDecomposition(m_K, m_ComponentCount, m_PCAEigenValues, m_V0);
+    m_K.clear();
+  }
+  else
   {
-    rowMeans(k) = m_K.get_row(k).mean();
+    MatrixType K0(m_K);
+    DoubleCenter(K0);
+
+    this->UpdatePeakMemoryUsage(MatrixBytes(m_AveVectorField) + MatrixBytes(m_K) + MatrixBytes(K0) +
+                                eigenSolverBytes);
+
+    EigenDecomposition(K0, m_SetSize, m_PCAEigenValues, m_V0);
   }
+}
 
-  TPCType    meanOfMeans = rowMeans.mean();
-  MatrixType K0(m_K - meanOfMeans);
-  for (unsigned int k = 0; k < m_SetSize; k++)
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::DoubleCenter(MatrixType & K)
+{
+  const unsigned int n = K.rows();
+
+  VectorType rowMeans(n);
+  for (unsigned int k = 0; k < n; k++)
+  {
+    rowMeans(k) = K.get_row(k).mean();
+  }
+
+  const TPCType meanOfMeans = rowMeans.mean();
+  for (unsigned int k = 0; k < n; k++)
   {
-    for (unsigned int l = 0; l < m_SetSize; l++)
+    for (unsigned int l = 0; l < n; l++)
     {
-      K0(k, l) -= rowMeans(k) + rowMeans(l);
+      K(k, l) += meanOfMeans - rowMeans(k) - rowMeans(l);
     }
   }
+}
 
+template <typename TVectorFieldElementType,
+          typename TPCType,
+          typename TPointSetPixelType,
+          typename TPointSetCoordRepType,
+          typename KernelFunctionType,
+          class TPointSetType>
+void
+VectorFieldPCA<TVectorFieldElementType,
+               TPCType,
+               TPointSetPixelType,
+               TPointSetCoordRepType,
+               KernelFunctionType,
+               TPointSetType>::EigenDecomposition(const MatrixType & K0,
+                                                  unsigned int       count,
+                                                  VectorType &       eigenValues,
+                                                  MatrixType &       V)
+{
   vnl_symmetric_eigensystem<TPCType> eigs(K0);
 
-  m_PCAEigenValues = eigs.D.diagonal();
+  const unsigned int n = K0.rows();
 
-  // Eigenvalues come out in ascending order, reorder them
-  m_PCAEigenValues.flip();
-
-  // Reorder eigenvectors
-  m_V0 = eigs.V;
-  m_V0.fliplr();
+  // Eigenvalues come out in ascending order, keep the largest ones in
+  // descending order
+  eigenValues.set_size(count);
+  V.set_size(n, count);
+  for (unsigned int k = 0; k < count; k++)
+  {
+    eigenValues(k) = eigs.get_eigenvalue(n - 1 - k);
+    V.set_column(k, eigs.get_eigenvector(n - 1 - k));
+  }
 
+  // Round-off can leave the eigenvalues of the null space slightly negative
   const double eigenvalue_epsilon = 1.0e-10;
-  for (unsigned int k = 0; k < m_SetSize; k++)
+  for (unsigned int k = 0; k < count; k++)
   {
-    m_V0.scale_column(k, 1.0 / std::sqrt(m_PCAEigenValues(k) + eigenvalue_epsilon));
+    V.scale_column(k, 1.0 / std::sqrt(std::max(eigenValues(k), TPCType(0.0)) + eigenvalue_epsilon));
   }
 }
 
@@ -305,11 +1840,16 @@ VectorFieldPCA<TVectorFieldElementType,
   }
   itkPrintSelfObjectMacro(BasisVectors);
 
+  os << indent << "LazyBasis: " << this->m_LazyBasis << std::endl;
+  os << indent << "BasisBlock dimensions: " << this->m_BasisBlock.rows() << "x" << this->m_BasisBlock.cols()
+     << std::endl;
+
   if (this->m_VectorFieldSet.IsNotNull())
   {
     os << indent << "Vector Field Set count: " << this->m_VectorFieldSet->Size() << std::endl;
   }
   itkPrintSelfObjectMacro(VectorFieldSet);
+  itkPrintSelfObjectMacro(VectorFieldImage);
 
   if (this->m_PointSet.IsNotNull())
   {
@@ -326,9 +1866,29 @@ VectorFieldPCA<TVectorFieldElementType,
   os << indent << "VertexCount: " << this->m_VertexCount << std::endl;
   os << indent << "PointDim: " << this->m_PointDim << std::endl;
 
-  os << indent << "V0 : " << this->m_V0 << std::endl;
-  os << indent << "AveVectorField: " << this->m_AveVectorField << std::endl;
-  os << indent << "K: " << this->m_K << std::endl;
+  os << indent << "V0 dimensions: " << this->m_V0.rows() << "x" << this->m_V0.cols() << std::endl;
+  os << indent << "AveVectorField dimensions: " << this->m_AveVectorField.rows() << "x"
+     << this->m_AveVectorField.cols() << std::endl;
+  os << indent << "K dimensions: " << this->m_K.rows() << "x" << this->m_K.cols() << std::endl;
+
+  itkPrintSelfObjectMacro(MultiThreader);
+
+  os << indent << "LowMemory: " << this->m_LowMemory << std::endl;
+  os << indent << "CheckpointDirectory: " << this->m_CheckpointDirectory << std::endl;
+  os << indent << "CheckpointInterval: " << this->m_CheckpointInterval << std::endl;
+  os << indent << "SketchSize: " << this->m_SketchSize << std::endl;
+  os << indent << "SketchSeed: " << this->m_SketchSeed << std::endl;
+  os << indent << "CoarseningFactor: " << this->m_CoarseningFactor << std::endl;
+  os << indent << "MultiresolutionRefinement: " << this->m_MultiresolutionRefinement << std::endl;
+  os << indent << "MultiresolutionValidation: " << this->m_MultiresolutionValidation << std::endl;
+  os << indent << "MultiresolutionSubspaceCosines: " << this->m_MultiresolutionSubspaceCosines << std::endl;
+  os << indent << "PeakMemoryUsage: " << this->m_PeakMemoryUsage << std::endl;
+
+  if (this->m_ReplicateEigenValues.IsNotNull())
+  {
+    os << indent << "Replicate count: " << this->m_ReplicateEigenValues->Size() << std::endl;
+  }
+  os << indent << "ReplicateSubspaceSimilarity: " << this->m_ReplicateSubspaceSimilarity << std::endl;
 
   os << indent << "PCACalculated: " << this->m_PCACalculated << std::endl;
 }
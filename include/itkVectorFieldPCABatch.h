@@ -0,0 +1,157 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+=========================================================================*/
+
+#ifndef itkVectorFieldPCABatch_h
+#define itkVectorFieldPCABatch_h
+
+#include "itkObject.h"
+#include "itkMultiThreaderBase.h"
+#include "itkNumericTraits.h"
+#include <string>
+#include <vector>
+
+namespace itk
+{
+
+/** \class VectorFieldPCABatch
+ * \brief Run many independent VectorFieldPCA calculators concurrently.
+ *
+ * Each job is a VectorFieldPCA calculator with its inputs and settings
+ * already set, typically one per anatomical structure. Jobs are started
+ * largest first, as many at a time as the memory budget allows, so the
+ * parallel phases of small jobs fill the gaps left by large ones.
+ *
+ * The memory needed by a job is taken from
+ * VectorFieldPCA::EstimatePeakMemoryUsage(). Once a job has finished, its
+ * results, VectorFieldPCA::GetOutputMemoryUsage(), still count against the
+ * budget. A job that does not fit in the budget runs alone.
+ *
+ * Each job gets a multithreader of the type of the batch multithreader,
+ * with its number of threads and work units. Only a TBBMultiThreader,
+ * which supports concurrent calls and schedules the work of all jobs by
+ * work stealing, is shared by the jobs. PoolMultiThreader instances keep
+ * separate state for each call but share the global thread pool.
+ *
+ * \ingroup PrincipalComponentsAnalysis
+ */
+
+template <typename TVectorFieldPCA>
+class ITK_TEMPLATE_EXPORT VectorFieldPCABatch : public Object
+{
+public:
+  ITK_DISALLOW_COPY_AND_MOVE(VectorFieldPCABatch);
+
+  /** Standard class type alias. */
+  using Self = VectorFieldPCABatch;
+  using Superclass = Object;
+  using Pointer = SmartPointer<Self>;
+  using ConstPointer = SmartPointer<const Self>;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(VectorFieldPCABatch, Object);
+
+  /** Type of the PCA calculators. */
+  using PCAType = TVectorFieldPCA;
+  using PCAPointer = typename PCAType::Pointer;
+
+  /**
+   * \brief Add a calculator to the batch. Return its job index.
+   */
+  unsigned int
+  AddJob(PCAType * job);
+
+  /**
+   * \brief Get the jobs.
+   */
+  unsigned int
+  GetNumberOfJobs() const
+  {
+    return static_cast<unsigned int>(m_Jobs.size());
+  }
+  PCAType *
+  GetJob(unsigned int i) const;
+
+  /**
+   * \brief Remove all the jobs.
+   */
+  void
+  ClearJobs();
+
+  /**
+   * \brief Set and get the memory budget, in bytes, shared by the running
+   * jobs. The default of 0 means no limit.
+   */
+  itkSetMacro(MemoryBudget, SizeValueType);
+  itkGetConstMacro(MemoryBudget, SizeValueType);
+
+  /**
+   * \brief Set and get the maximum number of jobs running at once. Each
+   * job already uses all the work units of the multithreader, so a few
+   * concurrent jobs are enough to keep them busy. The default is 2.
+   */
+  itkSetClampMacro(MaximumNumberOfConcurrentJobs, unsigned int, 1, NumericTraits<unsigned int>::max());
+  itkGetConstMacro(MaximumNumberOfConcurrentJobs, unsigned int);
+
+  /**
+   * \brief Set and get the multithreader whose type and settings the jobs
+   * use.
+   */
+  itkSetObjectMacro(MultiThreader, MultiThreaderBase);
+  itkGetModifiableObjectMacro(MultiThreader, MultiThreaderBase);
+
+  /**
+  * \brief Compute all the jobs.
+      A failing job does not stop the others. Once all jobs have finished,
+      an exception is thrown if any of them failed.
+  */
+  void
+  Compute();
+
+  /**
+   * \brief Return the error of job i in the last Compute(), or an empty
+   * string if it succeeded.
+   */
+  const std::string &
+  GetJobError(unsigned int i) const;
+
+protected:
+  VectorFieldPCABatch();
+  ~VectorFieldPCABatch() override = default;
+  void
+  PrintSelf(std::ostream & os, Indent indent) const override;
+
+private:
+  std::vector<PCAPointer>  m_Jobs;
+  std::vector<std::string> m_JobErrors;
+
+  MultiThreaderBase::Pointer m_MultiThreader;
+
+  SizeValueType m_MemoryBudget{ 0 };
+  unsigned int  m_MaximumNumberOfConcurrentJobs{ 2 };
+};
+
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#  include "itkVectorFieldPCABatch.hxx"
+#endif
+
+#endif
@@ -0,0 +1,214 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+=========================================================================*/
+
+#ifndef itkVectorFieldPCABatch_hxx
+#define itkVectorFieldPCABatch_hxx
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+namespace itk
+{
+
+template <typename TVectorFieldPCA>
+VectorFieldPCABatch<TVectorFieldPCA>::VectorFieldPCABatch()
+  : m_MultiThreader(MultiThreaderBase::New())
+{}
+
+template <typename TVectorFieldPCA>
+unsigned int
+VectorFieldPCABatch<TVectorFieldPCA>::AddJob(PCAType * job)
+{
+  if (!job)
+  {
+    itkExceptionMacro("Job is null.");
+  }
+
+  m_Jobs.push_back(job);
+  this->Modified();
+  return static_cast<unsigned int>(m_Jobs.size() - 1);
+}
+
+template <typename TVectorFieldPCA>
+auto
+VectorFieldPCABatch<TVectorFieldPCA>::GetJob(unsigned int i) const -> PCAType *
+{
+  if (i >= m_Jobs.size())
+  {
+    itkExceptionMacro("Job " << i << " is out of range (" << m_Jobs.size() << " jobs).");
+  }
+  return m_Jobs[i].GetPointer();
+}
+
+template <typename TVectorFieldPCA>
+void
+VectorFieldPCABatch<TVectorFieldPCA>::ClearJobs()
+{
+  m_Jobs.clear();
+  m_JobErrors.clear();
+  this->Modified();
+}
+
+template <typename TVectorFieldPCA>
+const std::string &
+VectorFieldPCABatch<TVectorFieldPCA>::GetJobError(unsigned int i) const
+{
+  if (i >= m_JobErrors.size())
+  {
+    itkExceptionMacro("Job " << i << " is out of range (" << m_JobErrors.size() << " computed jobs).");
+  }
+  return m_JobErrors[i];
+}
+
+template <typename TVectorFieldPCA>
+void
+VectorFieldPCABatch<TVectorFieldPCA>::Compute()
+{
+  const unsigned int jobCount = static_cast<unsigned int>(m_Jobs.size());
+  m_JobErrors.assign(jobCount, std::string());
+
+  // Only TBBMultiThreader supports concurrent calls on one instance. Other
+  // jobs get a multithreader of their own, of the same type; instances of
+  // PoolMultiThreader all share the global thread pool.
+  const bool shareMultiThreader = std::strcmp(m_MultiThreader->GetNameOfClass(), "TBBMultiThreader") == 0;
+
+  // Largest jobs first
+  std::vector<SizeValueType> jobMemory(jobCount);
+  std::vector<unsigned int>  pending(jobCount);
+  for (unsigned int j = 0; j < jobCount; j++)
+  {
+    if (shareMultiThreader)
+    {
+      m_Jobs[j]->SetMultiThreader(m_MultiThreader);
+    }
+    else
+    {
+      MultiThreaderBase::Pointer multiThreader =
+        dynamic_cast<MultiThreaderBase *>(m_MultiThreader->CreateAnother().GetPointer());
+      multiThreader->SetMaximumNumberOfThreads(m_MultiThreader->GetMaximumNumberOfThreads());
+      multiThreader->SetNumberOfWorkUnits(m_MultiThreader->GetNumberOfWorkUnits());
+      m_Jobs[j]->SetMultiThreader(multiThreader);
+    }
+    jobMemory[j] = m_Jobs[j]->EstimatePeakMemoryUsage();
+    pending[j] = j;
+  }
+  std::stable_sort(pending.begin(), pending.end(), [&jobMemory](unsigned int a, unsigned int b) {
+    return jobMemory[a] > jobMemory[b];
+  });
+
+  const unsigned int runnerCount = std::max(1u, std::min(m_MaximumNumberOfConcurrentJobs, jobCount));
+
+  std::mutex              mutex;
+  std::condition_variable jobFinished;
+  SizeValueType           memoryInUse = 0;
+  unsigned int            runningCount = 0;
+
+  // Each runner starts the largest pending job that fits in the budget,
+  // or the largest one when no other job is running
+  auto runner = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!pending.empty())
+    {
+      auto next = std::find_if(pending.begin(), pending.end(), [&](unsigned int j) {
+        return m_MemoryBudget == 0 || memoryInUse + jobMemory[j] <= m_MemoryBudget;
+      });
+      if (next == pending.end() && runningCount == 0)
+      {
+        next = pending.begin();
+      }
+      if (next == pending.end())
+      {
+        jobFinished.wait(lock);
+        continue;
+      }
+
+      const unsigned int job = *next;
+      pending.erase(next);
+      memoryInUse += jobMemory[job];
+      runningCount++;
+      lock.unlock();
+
+      try
+      {
+        m_Jobs[job]->Compute();
+      }
+      catch (const ExceptionObject & excp)
+      {
+        m_JobErrors[job] = excp.GetDescription();
+      }
+      catch (const std::exception & excp)
+      {
+        m_JobErrors[job] = excp.what();
+      }
+      catch (...)
+      {
+        m_JobErrors[job] = "Unknown exception.";
+      }
+
+      // The job keeps its results, which stay in the budget
+      lock.lock();
+      memoryInUse -= jobMemory[job];
+      memoryInUse += m_Jobs[job]->GetOutputMemoryUsage();
+      runningCount--;
+      jobFinished.notify_all();
+    }
+  };
+
+  std::vector<std::thread> runners;
+  for (unsigned int r = 1; r < runnerCount; r++)
+  {
+    runners.emplace_back(runner);
+  }
+  runner();
+  for (auto & thread : runners)
+  {
+    thread.join();
+  }
+
+  unsigned int failedCount = 0;
+  for (unsigned int j = 0; j < jobCount; j++)
+  {
+    if (!m_JobErrors[j].empty())
+    {
+      failedCount++;
+    }
+  }
+  if (failedCount)
+  {
+    itkExceptionMacro(failedCount << " of " << jobCount << " jobs failed. See GetJobError().");
+  }
+}
+
+template <typename TVectorFieldPCA>
+void
+VectorFieldPCABatch<TVectorFieldPCA>::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+
+  os << indent << "Job count: " << this->m_Jobs.size() << std::endl;
+  os << indent << "MemoryBudget: " << this->m_MemoryBudget << std::endl;
+  os << indent << "MaximumNumberOfConcurrentJobs: " << this->m_MaximumNumberOfConcurrentJobs << std::endl;
+
+  itkPrintSelfObjectMacro(MultiThreader);
+}
+} // end namespace itk
+
+#endif
@@ -0,0 +1,261 @@
+/*=========================================================================
+ *
+ *  Copyright NumFOCUS
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         https://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+=========================================================================*/
+
+#include "itkPointSet.h"
+#include "itkVectorFieldPCA.h"
+#include "itkVectorFieldPCABatch.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+#include "itkPlatformMultiThreader.h"
+#include "itkTestingMacros.h"
+#include <string>
+
+
+int
+itkVectorFieldPCABatchTest(int, char *[])
+{
+  int testStatus = EXIT_SUCCESS;
+
+  const unsigned int Dimension = 3;
+
+  using PointDataType = double;
+  using PixelType = itk::Array<PointDataType>;
+  using CoordRep = double;
+
+  using PCAResultsType = double;
+
+  // Declare the type of the input point set
+  using PointSetType = itk::PointSet<PixelType, Dimension>;
+
+  // Declare the type of the kernel function class
+  using KernelType = itk::GaussianDistanceKernel<CoordRep>;
+
+  // Declare the type of the PCA calculator
+  using PCACalculatorType =
+    itk::VectorFieldPCA<PointDataType, PCAResultsType, PixelType, CoordRep, KernelType, PointSetType>;
+
+  // Declare the type of the batch
+  using BatchType = itk::VectorFieldPCABatch<PCACalculatorType>;
+
+  BatchType::Pointer batch = BatchType::New();
+
+  ITK_EXERCISE_BASIC_OBJECT_METHODS(batch, VectorFieldPCABatch, Object);
+
+  // Synthetic structures of different sizes, as many as in a small atlas
+  const unsigned int                      fieldSetCount = 12;
+  const unsigned int                      pcaCount = 3;
+  const std::vector<unsigned int>         vertexCounts = { 40, 250, 90, 160, 60 };
+  const unsigned int                      structureCount = static_cast<unsigned int>(vertexCounts.size());
+  std::vector<PCACalculatorType::Pointer> sequential;
+
+  using GeneratorType = itk::Statistics::MersenneTwisterRandomVariateGenerator;
+  GeneratorType::Pointer generator = GeneratorType::New();
+  generator->Initialize(20131008);
+
+  KernelType::Pointer distKernel = KernelType::New();
+  distKernel->SetKernelSigma(6.25);
+
+  for (unsigned int s = 0; s < structureCount; s++)
+  {
+    PointSetType::Pointer pointSet = PointSetType::New();
+    for (unsigned int v = 0; v < vertexCounts[s]; v++)
+    {
+      PointSetType::PointType point;
+      for (unsigned int d = 0; d < Dimension; d++)
+      {
+        point[d] = 20.0 * generator->GetVariateWithClosedRange();
+      }
+      pointSet->SetPoint(v, point);
+    }
+
+    PCACalculatorType::VectorFieldSetTypePointer vectorFieldSet = PCACalculatorType::VectorFieldSetType::New();
+    vectorFieldSet->Reserve(fieldSetCount);
+    for (unsigned int i = 0; i < fieldSetCount; i++)
+    {
+      PCACalculatorType::VectorFieldType vectorField(vertexCounts[s], Dimension);
+      for (unsigned int v = 0; v < vertexCounts[s]; v++)
+      {
+        for (unsigned int d = 0; d < Dimension; d++)
+        {
+          vectorField(v, d) = generator->GetNormalVariate();
+        }
+      }
+      vectorFieldSet->SetElement(i, vectorField);
+    }
+
+    for (unsigned int copy = 0; copy < 2; copy++)
+    {
+      PCACalculatorType::Pointer pcaCalc = PCACalculatorType::New();
+      pcaCalc->SetComponentCount(pcaCount);
+      pcaCalc->SetPointSet(pointSet);
+      pcaCalc->SetVectorFieldSet(vectorFieldSet);
+      pcaCalc->SetKernelFunction(distKernel);
+      if (copy == 0)
+      {
+        sequential.push_back(pcaCalc);
+      }
+      else
+      {
+        ITK_TEST_EXPECT_EQUAL(s, batch->AddJob(pcaCalc));
+      }
+    }
+  }
+  ITK_TEST_EXPECT_EQUAL(structureCount, batch->GetNumberOfJobs());
+
+  for (const auto & pcaCalc : sequential)
+  {
+    ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalc->Compute());
+  }
+
+  // Run the batch without a budget, then with a budget that fits the two
+  // largest jobs, then with one that fits none of them
+  const itk::SizeValueType largestJob = batch->GetJob(1)->EstimatePeakMemoryUsage();
+  if (largestJob == 0)
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Job memory estimate is 0." << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  const std::vector<itk::SizeValueType> budgets = { 0, 2 * largestJob, 1 };
+  for (const auto budget : budgets)
+  {
+    batch->SetMemoryBudget(budget);
+    ITK_TEST_SET_GET_VALUE(budget, batch->GetMemoryBudget());
+
+    const unsigned int concurrentJobs = budget == 1 ? 1u : 2u;
+    batch->SetMaximumNumberOfConcurrentJobs(concurrentJobs);
+    ITK_TEST_SET_GET_VALUE(concurrentJobs, batch->GetMaximumNumberOfConcurrentJobs());
+
+    ITK_TRY_EXPECT_NO_EXCEPTION(batch->Compute());
+
+    for (unsigned int s = 0; s < structureCount; s++)
+    {
+      if (!batch->GetJobError(s).empty())
+      {
+        std::cout << "Test failed!" << std::endl;
+        std::cout << "Unexpected error in job " << s << ": " << batch->GetJobError(s) << std::endl;
+        testStatus = EXIT_FAILURE;
+      }
+
+      const auto & expected = sequential[s]->GetPCAEigenValues();
+      const auto & computed = batch->GetJob(s)->GetPCAEigenValues();
+      for (unsigned int k = 0; k < pcaCount; k++)
+      {
+        if (std::abs(computed(k) - expected(k)) > 1e-9 * expected(0))
+        {
+          std::cout << "Test failed!" << std::endl;
+          std::cout << "Error in eigenvalue at index [" << k << "] of job " << s << ", budget " << budget
+                    << std::endl;
+          std::cout << "Expected: " << expected(k) << ", but got: " << computed(k) << std::endl;
+          testStatus = EXIT_FAILURE;
+        }
+      }
+
+      const double basisDifference =
+        (batch->GetJob(s)->GetBasisVectors()->ElementAt(0) - sequential[s]->GetBasisVectors()->ElementAt(0))
+          .frobenius_norm();
+      if (basisDifference > 1e-9 * sequential[s]->GetBasisVectors()->ElementAt(0).frobenius_norm())
+      {
+        std::cout << "Test failed!" << std::endl;
+        std::cout << "Error in the first basis vector of job " << s << ", budget " << budget << std::endl;
+        testStatus = EXIT_FAILURE;
+      }
+    }
+  }
+
+  // Concurrent jobs do not share a multithreader, unless it is a
+  // TBBMultiThreader
+  if (std::string(batch->GetMultiThreader()->GetNameOfClass()) != "TBBMultiThreader")
+  {
+    for (unsigned int s = 1; s < structureCount; s++)
+    {
+      if (batch->GetJob(s)->GetMultiThreader() == batch->GetJob(0)->GetMultiThreader() ||
+          batch->GetJob(s)->GetMultiThreader() == batch->GetMultiThreader() ||
+          std::string(batch->GetJob(s)->GetMultiThreader()->GetNameOfClass()) !=
+            batch->GetMultiThreader()->GetNameOfClass())
+      {
+        std::cout << "Test failed!" << std::endl;
+        std::cout << "Job " << s << " does not have a multithreader of its own." << std::endl;
+        testStatus = EXIT_FAILURE;
+      }
+    }
+  }
+
+  // Jobs also run concurrently on PlatformMultiThreader instances
+  batch->SetMultiThreader(itk::PlatformMultiThreader::New());
+  batch->SetMemoryBudget(0);
+  batch->SetMaximumNumberOfConcurrentJobs(2);
+
+  ITK_TRY_EXPECT_NO_EXCEPTION(batch->Compute());
+
+  for (unsigned int s = 0; s < structureCount; s++)
+  {
+    const auto & expected = sequential[s]->GetPCAEigenValues();
+    const auto & computed = batch->GetJob(s)->GetPCAEigenValues();
+    if (std::abs(computed(0) - expected(0)) > 1e-9 * expected(0))
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in the leading eigenvalue of job " << s << " with PlatformMultiThreader" << std::endl;
+      std::cout << "Expected: " << expected(0) << ", but got: " << computed(0) << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  // Finished jobs hold their results
+  for (unsigned int s = 0; s < structureCount; s++)
+  {
+    if (batch->GetJob(s)->GetOutputMemoryUsage() == 0)
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Output memory usage of job " << s << " is 0." << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  // A failing job does not stop the others
+  const unsigned int failingJob = 2;
+  batch->GetJob(failingJob)->SetComponentCount(fieldSetCount + 1);
+  batch->SetMemoryBudget(0);
+
+  ITK_TRY_EXPECT_EXCEPTION(batch->Compute());
+
+  for (unsigned int s = 0; s < structureCount; s++)
+  {
+    if (batch->GetJobError(s).empty() == (s == failingJob))
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Unexpected error state of job " << s << ": \"" << batch->GetJobError(s) << "\"" << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  // The number of concurrent jobs is at least 1
+  batch->SetMaximumNumberOfConcurrentJobs(0);
+  ITK_TEST_SET_GET_VALUE(1u, batch->GetMaximumNumberOfConcurrentJobs());
+
+  // Test exceptions on out of range jobs
+  ITK_TRY_EXPECT_EXCEPTION(batch->GetJob(structureCount));
+  ITK_TRY_EXPECT_EXCEPTION(batch->GetJobError(structureCount));
+  ITK_TRY_EXPECT_EXCEPTION(batch->AddJob(nullptr));
+
+  batch->ClearJobs();
+  ITK_TEST_EXPECT_EQUAL(0u, batch->GetNumberOfJobs());
+
+  std::cout << "Test finished." << std::endl;
+  return testStatus;
+}
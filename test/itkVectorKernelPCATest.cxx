@@ -20,8 +20,11 @@
 #include "itkMeshFileReader.h"
 #include "itkVectorFieldPCA.h"
 #include "itkTestingMacros.h"
+#include "itksys/SystemTools.hxx"
 #include "vnl/vnl_vector.h"
 #include "vnl/vnl_vector.h"
+#include <algorithm>
+#include <cmath>
 
 
 template <typename TPixel, typename TMesh, typename TVectorContainer>
@@ -251,6 +254,473 @@ itkVectorKernelPCATest(int argc, char * argv[])
     testStatus = EXIT_FAILURE;
   }
 
+  // Resampling replicates: the full set, then leave-one-out, then a
+  // bootstrap replicate drawing every other field twice
+  PCACalculatorType::ReplicateSetType replicates;
+  PCACalculatorType::ReplicateType    fullReplicate;
+  for (unsigned int i = 0; i < fieldSetCount; i++)
+  {
+    fullReplicate.push_back(i);
+  }
+  replicates.push_back(fullReplicate);
+  for (unsigned int i = 0; i < fieldSetCount; i++)
+  {
+    PCACalculatorType::ReplicateType leaveOneOut(fullReplicate);
+    leaveOneOut.erase(leaveOneOut.begin() + i);
+    replicates.push_back(leaveOneOut);
+  }
+  PCACalculatorType::ReplicateType bootstrap;
+  for (unsigned int i = 0; i < fieldSetCount; i++)
+  {
+    bootstrap.push_back(2 * (i / 2));
+  }
+  replicates.push_back(bootstrap);
+
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalc->ComputeReplicates(replicates));
+
+  if (pcaCalc->GetReplicateEigenValues()->Size() != replicates.size() ||
+      pcaCalc->GetReplicateSubspaceCosines()->Size() != replicates.size() ||
+      pcaCalc->GetReplicateSubspaceSimilarity().size() != replicates.size())
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in ComputeReplicates() replicate count check." << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  // The full set replicate must reproduce the full set decomposition
+  const PCACalculatorType::VectorType & fullEigenValues = pcaCalc->GetReplicateEigenValues()->GetElement(0);
+  for (unsigned int k = 0; k < pcaCount; k++)
+  {
+    if (std::abs(fullEigenValues(k) - pcaCalc->GetPCAEigenValues()(k)) > 1e-6 * pcaCalc->GetPCAEigenValues()(0))
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in ComputeReplicates() eigenvalue at index [" << k << "]" << std::endl;
+      std::cout << "Expected: " << pcaCalc->GetPCAEigenValues()(k) << ", but got: " << fullEigenValues(k)
+                << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+  if (std::abs(pcaCalc->GetReplicateSubspaceSimilarity()(0) - 1.0) > 1e-6)
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in ComputeReplicates() subspace similarity of the full set." << std::endl;
+    std::cout << "Expected: 1, but got: " << pcaCalc->GetReplicateSubspaceSimilarity()(0) << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  // Removing one field, or resampling the set, barely moves the leading
+  // direction, and all the principal cosines are finite
+  for (unsigned int r = 1; r < replicates.size(); r++)
+  {
+    const PCACalculatorType::VectorType & cosines = pcaCalc->GetReplicateSubspaceCosines()->GetElement(r);
+    const PCACalculatorType::VectorType & eigenValues = pcaCalc->GetReplicateEigenValues()->GetElement(r);
+    for (unsigned int k = 0; k < pcaCount; k++)
+    {
+      if (!std::isfinite(cosines(k)) || cosines(k) < 0.0 || cosines(k) > 1.0 || !std::isfinite(eigenValues(k)))
+      {
+        std::cout << "Test failed!" << std::endl;
+        std::cout << "Error in ComputeReplicates() replicate " << r << " at index [" << k << "]" << std::endl;
+        std::cout << "Got cosine: " << cosines(k) << ", eigenvalue: " << eigenValues(k) << std::endl;
+        testStatus = EXIT_FAILURE;
+      }
+    }
+    if (cosines(0) < 0.9)
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in ComputeReplicates() leading cosine of replicate " << r << std::endl;
+      std::cout << "Expected at least: 0.9, but got: " << cosines(0) << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  // Test exception when a replicate index is out of range
+  replicates.back().push_back(fieldSetCount);
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalc->ComputeReplicates(replicates));
+  replicates.back().pop_back();
+
+  // Test exception when a replicate has too few distinct fields to span
+  // ComponentCount directions
+  PCACalculatorType::ReplicateSetType degenerateReplicates(1);
+  for (unsigned int i = 0; i < fieldSetCount; i++)
+  {
+    degenerateReplicates[0].push_back(i % pcaCount);
+  }
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalc->ComputeReplicates(degenerateReplicates));
+
+  // Low memory mode must give the same decomposition as the default mode
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalc->Compute());
+
+  PCACalculatorType::Pointer pcaCalcLowMemory = PCACalculatorType::New();
+  pcaCalcLowMemory->SetComponentCount(pcaCount);
+  pcaCalcLowMemory->SetPointSet(mesh);
+  pcaCalcLowMemory->SetVectorFieldSet(vectorFieldSet);
+  pcaCalcLowMemory->SetKernelFunction(distKernel);
+  ITK_TEST_SET_GET_BOOLEAN(pcaCalcLowMemory, LowMemory, true);
+
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcLowMemory->Compute());
+
+  for (unsigned int k = 0; k < pcaCount; k++)
+  {
+    if (std::abs(pcaCalcLowMemory->GetPCAEigenValues()(k) - pcaCalc->GetPCAEigenValues()(k)) >
+        1e-6 * pcaCalc->GetPCAEigenValues()(0))
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in LowMemory eigenvalue at index [" << k << "]" << std::endl;
+      std::cout << "Expected: " << pcaCalc->GetPCAEigenValues()(k)
+                << ", but got: " << pcaCalcLowMemory->GetPCAEigenValues()(k) << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  if (pcaCalcLowMemory->GetPeakMemoryUsage() == 0 ||
+      pcaCalcLowMemory->GetPeakMemoryUsage() >= pcaCalc->GetPeakMemoryUsage())
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in LowMemory peak memory usage." << std::endl;
+    std::cout << "Expected less than: " << pcaCalc->GetPeakMemoryUsage()
+              << ", but got: " << pcaCalcLowMemory->GetPeakMemoryUsage() << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  // The Gram matrix is released in low memory mode
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcLowMemory->ComputeReplicates(replicates));
+
+  // Lazy basis reconstruction must give the same basis vectors
+  PCACalculatorType::Pointer pcaCalcLazy = PCACalculatorType::New();
+  pcaCalcLazy->SetComponentCount(pcaCount);
+  pcaCalcLazy->SetPointSet(mesh);
+  pcaCalcLazy->SetVectorFieldSet(vectorFieldSet);
+  pcaCalcLazy->SetKernelFunction(distKernel);
+  ITK_TEST_SET_GET_BOOLEAN(pcaCalcLazy, LazyBasis, true);
+
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcLazy->GetBasisVector(0));
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcLazy->Compute());
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcLazy->GetBasisVector(pcaCount));
+
+  // The basis block stays valid when the basis set is built after it
+  const PCACalculatorType::MatrixType &   expectedBasisBlock = pcaCalc->GetBasisBlock();
+  const PCACalculatorType::MatrixType *   expectedBasisBlockAddress = &expectedBasisBlock;
+  const PCAResultsType *                  expectedBasisBlockData = expectedBasisBlock.data_block();
+  const PCACalculatorType::BasisSetType * expectedBasisVectors = pcaCalc->GetBasisVectors();
+  if (&pcaCalc->GetBasisBlock() != expectedBasisBlockAddress ||
+      pcaCalc->GetBasisBlock().data_block() != expectedBasisBlockData)
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in GetBasisBlock(): the block moved after GetBasisVectors()." << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+  for (unsigned int j = pcaCount; j-- > 0;)
+  {
+    const PCACalculatorType::MatrixType expectedBasisVector = expectedBasisVectors->GetElement(j);
+    const PCACalculatorType::MatrixType computedBasisVector = pcaCalcLazy->GetBasisVector(j);
+    const double                        tolerance = 1e-6 * expectedBasisVector.absolute_value_max();
+    if ((computedBasisVector - expectedBasisVector).absolute_value_max() > tolerance ||
+        std::abs(expectedBasisBlock(j, 0) - expectedBasisVector(0, 0)) > tolerance)
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in lazy GetBasisVector() at index [" << j << "]" << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  // The basis set is available from a const calculator, and matches the
+  // basis vectors
+  const PCACalculatorType * constPcaCalcLazy = pcaCalcLazy.GetPointer();
+  if (constPcaCalcLazy->GetBasisVectors()->Size() != pcaCount ||
+      (constPcaCalcLazy->GetBasisVector(0) - constPcaCalcLazy->GetBasisVectors()->GetElement(0))
+          .absolute_value_max() != 0.0)
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in const GetBasisVectors()." << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  // The lazy basis is not reconstructed from vector fields that have
+  // changed since Compute()
+  PCACalculatorType::VectorFieldSetTypePointer smallerFieldSet = PCACalculatorType::VectorFieldSetType::New();
+  for (unsigned int i = 0; i + 1 < fieldSetCount; i++)
+  {
+    smallerFieldSet->InsertElement(i, vectorFieldSet->GetElement(i));
+  }
+
+  PCACalculatorType::Pointer pcaCalcStale = PCACalculatorType::New();
+  pcaCalcStale->SetComponentCount(pcaCount);
+  pcaCalcStale->SetPointSet(mesh);
+  pcaCalcStale->SetVectorFieldSet(vectorFieldSet);
+  pcaCalcStale->SetKernelFunction(distKernel);
+  pcaCalcStale->LazyBasisOn();
+
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcStale->Compute());
+  pcaCalcStale->SetVectorFieldSet(smallerFieldSet);
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcStale->GetBasisVector(0));
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcStale->GetBasisBlock());
+
+  // Nor after a failed Compute()
+  pcaCalcStale->SetVectorFieldSet(vectorFieldSet);
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcStale->Compute());
+  pcaCalcStale->SetComponentCount(fieldSetCount + 1);
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcStale->Compute());
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcStale->GetBasisVector(0));
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcStale->GetBasisBlock());
+  ITK_TEST_EXPECT_EQUAL(0u, pcaCalcStale->GetBasisVectors()->Size());
+
+  // Multiresolution mode without refinement: the rescaled coarse
+  // eigenvalues are within 20% of the exact ones
+  PCACalculatorType::Pointer pcaCalcCoarse = PCACalculatorType::New();
+  pcaCalcCoarse->SetComponentCount(pcaCount);
+  pcaCalcCoarse->SetPointSet(mesh);
+  pcaCalcCoarse->SetVectorFieldSet(vectorFieldSet);
+  pcaCalcCoarse->SetKernelFunction(distKernel);
+  pcaCalcCoarse->SetCoarseningFactor(2);
+  ITK_TEST_SET_GET_BOOLEAN(pcaCalcCoarse, MultiresolutionRefinement, false);
+
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcCoarse->Compute());
+
+  for (unsigned int k = 0; k < pcaCount; k++)
+  {
+    const double expected = pcaCalc->GetPCAEigenValues()(k);
+    const double computed = pcaCalcCoarse->GetPCAEigenValues()(k);
+    if (std::abs(computed - expected) > 0.2 * expected)
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in unrefined multiresolution eigenvalue at index [" << k << "]" << std::endl;
+      std::cout << "Expected: " << expected << " within 20%, but got: " << computed << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  // Multiresolution mode with refinement and validation
+  PCACalculatorType::Pointer pcaCalcMultiresolution = PCACalculatorType::New();
+  pcaCalcMultiresolution->SetComponentCount(pcaCount);
+  pcaCalcMultiresolution->SetPointSet(mesh);
+  pcaCalcMultiresolution->SetVectorFieldSet(vectorFieldSet);
+  pcaCalcMultiresolution->SetKernelFunction(distKernel);
+  pcaCalcMultiresolution->SetCoarseningFactor(2);
+  ITK_TEST_SET_GET_VALUE(2u, pcaCalcMultiresolution->GetCoarseningFactor());
+  ITK_TEST_SET_GET_BOOLEAN(pcaCalcMultiresolution, MultiresolutionRefinement, true);
+  ITK_TEST_SET_GET_BOOLEAN(pcaCalcMultiresolution, MultiresolutionValidation, true);
+
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcMultiresolution->Compute());
+
+  const PCACalculatorType::VectorType & multiresolutionCosines =
+    pcaCalcMultiresolution->GetMultiresolutionSubspaceCosines();
+  if (multiresolutionCosines.size() != pcaCount || multiresolutionCosines.min_value() < 0.0 ||
+      multiresolutionCosines.max_value() > 1.0)
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in GetMultiresolutionSubspaceCosines(): " << multiresolutionCosines << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  // After refinement, the leading directions match the exact subspace
+  for (unsigned int k = 0; k + 1 < pcaCount && k < multiresolutionCosines.size(); k++)
+  {
+    if (multiresolutionCosines(k) < 0.95)
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in multiresolution subspace cosine at index [" << k << "]" << std::endl;
+      std::cout << "Expected at least: 0.95, but got: " << multiresolutionCosines(k) << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  // Rayleigh-Ritz eigenvalues cannot exceed the exact ones
+  for (unsigned int k = 0; k < pcaCount; k++)
+  {
+    if (pcaCalcMultiresolution->GetPCAEigenValues()(k) >
+        pcaCalc->GetPCAEigenValues()(k) + 1e-6 * pcaCalc->GetPCAEigenValues()(0))
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in multiresolution eigenvalue at index [" << k << "]" << std::endl;
+      std::cout << "Expected at most: " << pcaCalc->GetPCAEigenValues()(k)
+                << ", but got: " << pcaCalcMultiresolution->GetPCAEigenValues()(k) << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  // Sketched Gram matrices, down to half the field size, approximate the
+  // exact decomposition and are reproducible for a given seed
+  const unsigned int sketchSize = vectorFieldSet->GetElement(0).size() / 2;
+
+  PCACalculatorType::Pointer pcaCalcSketch = PCACalculatorType::New();
+  pcaCalcSketch->SetComponentCount(pcaCount);
+  pcaCalcSketch->SetPointSet(mesh);
+  pcaCalcSketch->SetVectorFieldSet(vectorFieldSet);
+  pcaCalcSketch->SetKernelFunction(distKernel);
+  pcaCalcSketch->SetSketchSize(sketchSize);
+  ITK_TEST_SET_GET_VALUE(sketchSize, pcaCalcSketch->GetSketchSize());
+  pcaCalcSketch->SetSketchSeed(42);
+  ITK_TEST_SET_GET_VALUE(42u, pcaCalcSketch->GetSketchSeed());
+
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcSketch->Compute());
+  const PCACalculatorType::VectorType sketchEigenValues = pcaCalcSketch->GetPCAEigenValues();
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcSketch->Compute());
+
+  if (sketchEigenValues.size() != pcaCount || sketchEigenValues != pcaCalcSketch->GetPCAEigenValues())
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in sketched eigenvalues reproducibility." << std::endl;
+    std::cout << "Expected: " << sketchEigenValues << ", but got: " << pcaCalcSketch->GetPCAEigenValues()
+              << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  for (unsigned int k = 0; k < pcaCount; k++)
+  {
+    if (std::abs(sketchEigenValues(k) - pcaCalc->GetPCAEigenValues()(k)) > 0.1 * pcaCalc->GetPCAEigenValues()(0))
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in sketched eigenvalue at index [" << k << "]" << std::endl;
+      std::cout << "Expected: " << pcaCalc->GetPCAEigenValues()(k) << ", but got: " << sketchEigenValues(k)
+                << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  const PCACalculatorType::MatrixType & sketchBasisBlock = pcaCalcSketch->GetBasisBlock();
+  const PCACalculatorType::MatrixType & exactBasisBlock = pcaCalc->GetBasisBlock();
+  const double                          leadingCosine =
+    std::abs(dot_product(sketchBasisBlock.get_row(0), exactBasisBlock.get_row(0))) /
+    (sketchBasisBlock.get_row(0).two_norm() * exactBasisBlock.get_row(0).two_norm());
+  if (leadingCosine < 0.9)
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in sketched leading basis vector." << std::endl;
+    std::cout << "Expected a cosine with the exact one of at least 0.9, but got: " << leadingCosine << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  // Checkpointed computation from scratch, then resumed from the complete
+  // checkpoint, then from a partially lost one, then with a stale one
+  const std::string checkpointDirectory = "itkVectorKernelPCATestCheckpoint";
+  itksys::SystemTools::RemoveADirectory(checkpointDirectory);
+
+  const unsigned int              checkpointInterval = 4;
+  const unsigned int              keptRowCount = 2 * checkpointInterval;
+  const std::vector<unsigned int> expectedRestoredRowCounts = { 0, fieldSetCount, keptRowCount, 0 };
+
+  KernelType::Pointer staleKernel = KernelType::New();
+  staleKernel->SetKernelSigma(2.0 * kernelSigma);
+
+  PCACalculatorType::Pointer pcaCalcCheckpoint;
+  for (unsigned int run = 0; run < expectedRestoredRowCounts.size(); run++)
+  {
+    const bool stale = run == 3;
+
+    if (run == 2)
+    {
+      // Tiles that did not reach the disk before a crash
+      std::fstream gram((checkpointDirectory + "/gram.bin").c_str(), std::ios::binary | std::ios::in | std::ios::out);
+      const std::vector<char> zeros(static_cast<std::size_t>(fieldSetCount - keptRowCount) * fieldSetCount *
+                                      sizeof(PCAResultsType),
+                                    0);
+      gram.seekp(static_cast<std::streamoff>(keptRowCount) * fieldSetCount * sizeof(PCAResultsType));
+      gram.write(zeros.data(), zeros.size());
+    }
+
+    pcaCalcCheckpoint = PCACalculatorType::New();
+    pcaCalcCheckpoint->SetComponentCount(pcaCount);
+    pcaCalcCheckpoint->SetPointSet(mesh);
+    pcaCalcCheckpoint->SetVectorFieldSet(vectorFieldSet);
+    pcaCalcCheckpoint->SetKernelFunction(stale ? staleKernel : distKernel);
+    pcaCalcCheckpoint->SetCheckpointDirectory(checkpointDirectory);
+    ITK_TEST_SET_GET_VALUE(checkpointDirectory, std::string(pcaCalcCheckpoint->GetCheckpointDirectory()));
+    pcaCalcCheckpoint->SetCheckpointInterval(checkpointInterval);
+    ITK_TEST_SET_GET_VALUE(checkpointInterval, pcaCalcCheckpoint->GetCheckpointInterval());
+
+    ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcCheckpoint->Compute());
+
+    if (pcaCalcCheckpoint->GetCheckpointRestoredRowCount() != expectedRestoredRowCounts[run])
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in checkpoint restored row count, run " << run << std::endl;
+      std::cout << "Expected: " << expectedRestoredRowCounts[run]
+                << ", but got: " << pcaCalcCheckpoint->GetCheckpointRestoredRowCount() << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+
+    for (unsigned int k = 0; k < pcaCount && !stale; k++)
+    {
+      if (std::abs(pcaCalcCheckpoint->GetPCAEigenValues()(k) - pcaCalc->GetPCAEigenValues()(k)) >
+          1e-6 * pcaCalc->GetPCAEigenValues()(0))
+      {
+        std::cout << "Test failed!" << std::endl;
+        std::cout << "Error in checkpointed eigenvalue at index [" << k << "], run " << run << std::endl;
+        std::cout << "Expected: " << pcaCalc->GetPCAEigenValues()(k)
+                  << ", but got: " << pcaCalcCheckpoint->GetPCAEigenValues()(k) << std::endl;
+        testStatus = EXIT_FAILURE;
+      }
+    }
+  }
+
+  // Test exception when checkpointing an unsupported mode
+  pcaCalcCheckpoint->LowMemoryOn();
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcCheckpoint->Compute());
+
+  itksys::SystemTools::RemoveADirectory(checkpointDirectory);
+
+  // Vector fields in one contiguous buffer must give the same decomposition
+  // as the vector field set
+  using VectorFieldImageType = PCACalculatorType::VectorFieldImageType;
+  const PCACalculatorType::VectorFieldType & firstField = vectorFieldSet->GetElement(0);
+
+  VectorFieldImageType::SizeType vectorFieldImageSize;
+  vectorFieldImageSize[0] = firstField.cols();
+  vectorFieldImageSize[1] = firstField.rows();
+  vectorFieldImageSize[2] = fieldSetCount;
+
+  VectorFieldImageType::Pointer vectorFieldImage = VectorFieldImageType::New();
+  vectorFieldImage->SetRegions(vectorFieldImageSize);
+  vectorFieldImage->Allocate();
+  for (unsigned int j = 0; j < fieldSetCount; j++)
+  {
+    const PCACalculatorType::VectorFieldType & field = vectorFieldSet->GetElement(j);
+    std::copy(field.begin(), field.end(), vectorFieldImage->GetBufferPointer() + j * field.size());
+  }
+
+  PCACalculatorType::Pointer pcaCalcImage = PCACalculatorType::New();
+  pcaCalcImage->SetComponentCount(pcaCount);
+  pcaCalcImage->SetPointSet(mesh);
+  pcaCalcImage->SetVectorFieldImage(vectorFieldImage);
+  ITK_TEST_SET_GET_VALUE(vectorFieldImage.GetPointer(), pcaCalcImage->GetVectorFieldImage());
+  pcaCalcImage->SetKernelFunction(distKernel);
+
+  if (pcaCalcImage->EstimatePeakMemoryUsage() != pcaCalc->EstimatePeakMemoryUsage())
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in the peak memory estimate of the vector field image." << std::endl;
+    std::cout << "Expected: " << pcaCalc->EstimatePeakMemoryUsage()
+              << ", but got: " << pcaCalcImage->EstimatePeakMemoryUsage() << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  ITK_TRY_EXPECT_NO_EXCEPTION(pcaCalcImage->Compute());
+
+  for (unsigned int k = 0; k < pcaCount; k++)
+  {
+    if (std::abs(pcaCalcImage->GetPCAEigenValues()(k) - pcaCalc->GetPCAEigenValues()(k)) >
+        1e-9 * pcaCalc->GetPCAEigenValues()(0))
+    {
+      std::cout << "Test failed!" << std::endl;
+      std::cout << "Error in vector field image eigenvalue at index [" << k << "]" << std::endl;
+      std::cout << "Expected: " << pcaCalc->GetPCAEigenValues()(k)
+                << ", but got: " << pcaCalcImage->GetPCAEigenValues()(k) << std::endl;
+      testStatus = EXIT_FAILURE;
+    }
+  }
+
+  const double imageBasisDifference = (pcaCalcImage->GetBasisBlock() - pcaCalc->GetBasisBlock()).frobenius_norm();
+  if (imageBasisDifference > 1e-9 * pcaCalc->GetBasisBlock().frobenius_norm())
+  {
+    std::cout << "Test failed!" << std::endl;
+    std::cout << "Error in vector field image basis vectors: difference " << imageBasisDifference << std::endl;
+    testStatus = EXIT_FAILURE;
+  }
+
+  // Test exception when both the vector field set and image are set
+  pcaCalcImage->SetVectorFieldSet(vectorFieldSet);
+  ITK_TRY_EXPECT_EXCEPTION(pcaCalcImage->Compute());
+
   // Test exception when trying to compute with a requested input count greater
   // than the number of vector field sets
   pcaCalc->SetComponentCount(fieldSetCount + 1);
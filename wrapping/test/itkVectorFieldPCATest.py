@@ -0,0 +1,87 @@
+# ==========================================================================
+#
+#   Copyright NumFOCUS
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#          https://www.apache.org/licenses/LICENSE-2.0.txt
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+# ==========================================================================
+
+# The vector fields are passed to VectorFieldPCA in place, from one N x V x D
+# NumPy array, and must give the same decomposition as a vector field set.
+
+import itk
+import numpy as np
+
+t = itk.F
+PointSetType = itk.PointSet[t, 3]
+PCAType = itk.VectorFieldPCA[t, t, t, itk.F, itk.KernelFunctionBase[itk.F], PointSetType]
+
+field_count, vertex_count, point_dim, pca_count = 12, 50, 3, 3
+
+rng = np.random.default_rng(20131008)
+points = (20.0 * rng.random((vertex_count, point_dim))).astype(np.float32)
+fields = rng.standard_normal((field_count, vertex_count, point_dim)).astype(np.float32)
+
+point_set = PointSetType.New()
+point_set.SetPoints(itk.vector_container_from_array(points.ravel()))
+
+kernel = itk.GaussianDistanceKernel[itk.F].New()
+kernel.SetKernelSigma(6.25)
+
+
+def new_pca():
+    pca = PCAType.New()
+    pca.SetPointSet(point_set)
+    pca.SetKernelFunction(kernel)
+    pca.SetComponentCount(pca_count)
+    return pca
+
+
+# Reference: one vnl_matrix per sample
+field_set = itk.VectorContainer[itk.UI, itk.vnl_matrix[t]].New()
+field_set.Reserve(field_count)
+for i, field in enumerate(fields):
+    field_set.SetElement(i, itk.vnl_matrix_from_array(field))
+
+pca_set = new_pca()
+pca_set.SetVectorFieldSet(field_set)
+pca_set.Compute()
+
+# Zero-copy: the array is read in place
+field_image = itk.image_view_from_array(fields)
+assert tuple(field_image.GetBufferedRegion().GetSize()) == (point_dim, vertex_count, field_count)
+
+pca_image = new_pca()
+pca_image.SetVectorFieldImage(field_image)
+assert np.shares_memory(fields, itk.array_view_from_image(pca_image.GetVectorFieldImage()))
+pca_image.Compute()
+
+expected = itk.array_from_vnl_vector(pca_set.GetPCAEigenValues())
+computed = itk.array_view_from_vnl_vector(pca_image.GetPCAEigenValues())
+assert np.allclose(computed, expected, rtol=1e-5, atol=1e-5 * expected[0]), (computed, expected)
+
+# The basis is one k x (V * D) block; row k reshapes to basis vector k
+basis = itk.array_view_from_vnl_matrix(pca_image.GetBasisBlock())
+assert basis.shape == (pca_count, vertex_count * point_dim)
+for k in range(pca_count):
+    expected_basis = itk.array_from_vnl_matrix(pca_set.GetBasisVector(k))
+    assert np.allclose(basis[k].reshape(vertex_count, point_dim), expected_basis, atol=1e-4), k
+
+# Both inputs at once are rejected
+pca_image.SetVectorFieldSet(field_set)
+try:
+    pca_image.Compute()
+except RuntimeError:
+    pass
+else:
+    raise AssertionError("Compute() accepted both a vector field set and image")